@@ -0,0 +1,397 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graphics/texture.h"
+
+#include "asset_cache.h"
+#include "bench.h"
+#include "frame_sink.h"
+#include "frame_workers.h"
+#include "profiler.h"
+#include "render_target.h"
+#include "scene.h"
+#include "scene_renderer.h"
+
+// One frame is rendered while up to two earlier ones are being saved.
+#define OUTPUT_BUFFER_COUNT 3
+// Longest line of a job list, including the newline.
+#define JOB_LINE_SIZE 512
+// Most scales ANIM_PREVIEW can list.
+#define MAX_PREVIEW_SCALES 4
+
+static void render_frame(struct render_target *target, int frame,
+                         void *context) {
+    const struct scene_context *scene_context = context;
+    double start = get_profile_time();
+    render_scene_frame(target, scene_context, frame);
+    if (!save_frame(target, frame)) {
+        printf("Cannot write frame %d.\n", frame);
+    }
+    add_profile_time(PROFILE_STAGE_FRAME, start);
+    write_frame_profile(scene_context->scene->output_directory, frame);
+}
+
+// Parses ANIM_PREVIEW, a comma-separated list of scales, into scales. The
+// frames of every scene are rendered once for each scale, in the given order,
+// at 1/scale of their width and height, so "4,1" gives a quick preview of all
+// frames before the exact ones. Returns the number of scales, which is 1 for
+// full size if the variable is not set. A stream or raw file only takes frames
+// of one size, so with ANIM_OUTPUT only the last scale is kept.
+static int get_preview_scales(int *scales) {
+    const char *value = getenv("ANIM_PREVIEW");
+    int count = 0;
+    while (value != NULL && *value != '\0' && count < MAX_PREVIEW_SCALES) {
+        char *end;
+        long scale = strtol(value, &end, 10);
+        if (end == value) {
+            break;
+        }
+        if (scale > 0 && scale <= 64) {
+            scales[count++] = (int)scale;
+        }
+        value = *end == ',' ? end + 1 : end;
+    }
+    if (count == 0) {
+        scales[count++] = 1;
+    }
+    const char *output = getenv("ANIM_OUTPUT");
+    if (output != NULL && output[0] != '\0' && count > 1) {
+        scales[0] = scales[count - 1];
+        count = 1;
+    }
+    return count;
+}
+
+static uint32_t scale_size(uint32_t size, int scale) {
+    return (size + (uint32_t)scale - 1) / (uint32_t)scale;
+}
+
+// A scene and everything opened to render one range of its frames.
+struct scene_job {
+    struct scene *scene;
+    struct frame_range range;
+    // NULL if the frames are saved under the names of the scene.
+    char *name_format;
+    struct frame_sink *sink;
+    struct render_target_settings settings;
+    struct scene_context context;
+};
+
+// Loads the scene file through the cache and opens its frame output, for
+// frames rendered at 1/scale of their size. The frames are narrowed by the
+// ANIM_*_FRAME variables, then by first, end and stride where they are not
+// negative. Returns false if anything cannot be opened.
+static bool open_scene_job(struct scene_job *job, const char *path, int first,
+                           int end, int stride, int scale,
+                           struct asset_cache *cache,
+                           struct texture *unlit_shadow_map) {
+    job->scene = load_scene(path, cache);
+    if (job->scene == NULL) {
+        return false;
+    }
+    const struct scene *scene = job->scene;
+    const char *name_format = scene->output_name_format;
+    job->name_format = NULL;
+    if (scale > 1) {
+        // Previews are saved next to the frames under names of their own, so
+        // that they are never taken for finished frames.
+        size_t size = strlen(name_format) + 32;
+        job->name_format = malloc(size);
+        if (job->name_format == NULL) {
+            printf("Cannot allocate memory for the job list.\n");
+            destroy_scene(job->scene);
+            return false;
+        }
+        snprintf(job->name_format, size, "preview-%d-%s", scale, name_format);
+        name_format = job->name_format;
+    }
+    uint32_t width = scale_size(scene->image_width, scale);
+    uint32_t height = scale_size(scene->image_height, scale);
+    int frame_count = get_scene_frame_count(scene);
+    job->range = get_frame_range(frame_count);
+    if (first >= 0) {
+        job->range.first = first;
+    }
+    if (end >= 0) {
+        job->range.end = end;
+    }
+    if (stride >= 0) {
+        job->range.stride = stride;
+    }
+    clamp_frame_range(&job->range, frame_count);
+    job->sink = open_frame_sink(scene->output_directory, name_format, width,
+                                height, job->range.first, job->range.stride);
+    if (job->sink == NULL) {
+        printf("Cannot open frame output.\n");
+        free(job->name_format);
+        destroy_scene(job->scene);
+        return false;
+    }
+    uint32_t shadow_map_width = scale_size(scene->shadow_map_width, scale);
+    uint32_t shadow_map_height = scale_size(scene->shadow_map_height, scale);
+    struct render_target_settings settings = {
+        width,                    height,
+        shadow_map_width,         shadow_map_height,
+        get_tile_thread_count(),  get_depth_prepass(),
+        get_max_lod_error(),      OUTPUT_BUFFER_COUNT,
+        job->sink};
+    job->settings = settings;
+    job->context.scene = scene;
+    job->context.unlit_shadow_map = unlit_shadow_map;
+    return true;
+}
+
+static void close_scene_job(struct scene_job *job) {
+    close_frame_sink(job->sink);
+    free(job->name_format);
+    destroy_scene(job->scene);
+}
+
+// Renders the frames of all jobs across one pool of workers, then closes the
+// jobs.
+static bool render_scene_jobs(struct scene_job *jobs, int job_count) {
+    // One more so that an empty job list does not allocate zero bytes.
+    struct frame_job *frame_jobs =
+        malloc(sizeof(struct frame_job) * ((size_t)job_count + 1));
+    bool succeeded = frame_jobs != NULL;
+    if (succeeded) {
+        for (int i = 0; i < job_count; i++) {
+            frame_jobs[i].settings = &jobs[i].settings;
+            frame_jobs[i].range = jobs[i].range;
+            frame_jobs[i].render_frame = render_frame;
+            frame_jobs[i].context = &jobs[i].context;
+        }
+        succeeded = render_jobs(frame_jobs, job_count, get_worker_count());
+    } else {
+        printf("Cannot allocate memory for the job list.\n");
+    }
+    free(frame_jobs);
+    for (int i = 0; i < job_count; i++) {
+        close_scene_job(&jobs[i]);
+    }
+    return succeeded;
+}
+
+// Parses "<scene file> [<first frame> [<end frame> [<frame stride>]]]" and
+// opens one job into jobs for each preview scale. Returns false if the line is
+// invalid or a job cannot be opened, in which case no job is left open.
+static bool parse_job(char *line, struct scene_job *jobs, const int *scales,
+                      int scale_count, struct asset_cache *cache,
+                      struct texture *unlit_shadow_map) {
+    const char *path = strtok(line, " \t\r\n");
+    int numbers[3] = {-1, -1, -1};
+    for (int i = 0; i < 4; i++) {
+        const char *token = strtok(NULL, " \t\r\n");
+        if (token == NULL) {
+            break;
+        }
+        char *end;
+        long number = strtol(token, &end, 10);
+        if (i == 3 || *end != '\0' || number < 0 || number > INT_MAX) {
+            printf("Cannot parse the job of %s.\n", path);
+            return false;
+        }
+        numbers[i] = (int)number;
+    }
+    for (int i = 0; i < scale_count; i++) {
+        if (!open_scene_job(jobs + i, path, numbers[0], numbers[1], numbers[2],
+                            scales[i], cache, unlit_shadow_map)) {
+            for (int j = 0; j < i; j++) {
+                close_scene_job(&jobs[j]);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+// Reads jobs from the standard input, one per line, until it ends. Jobs are
+// collected into a batch until an empty line, then all frames of the batch
+// are rendered across one pool of workers. Assets stay loaded between
+// batches. The replies go to the standard output, so frames cannot be
+// streamed to it.
+static void serve_jobs(struct asset_cache *cache,
+                       struct texture *unlit_shadow_map) {
+    const char *output = getenv("ANIM_OUTPUT");
+    if (output != NULL && strcmp(output, "-") == 0) {
+        printf("Cannot stream frames to the standard output while reading "
+               "jobs.\n");
+        return;
+    }
+    struct scene_job *jobs = NULL;
+    int job_count = 0;
+    int job_capacity = 0;
+    int scales[MAX_PREVIEW_SCALES];
+    int scale_count = get_preview_scales(scales);
+    char line[JOB_LINE_SIZE];
+    for (;;) {
+        bool ended = fgets(line, JOB_LINE_SIZE, stdin) == NULL;
+        char *comment = ended ? NULL : strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        bool empty = ended || strspn(line, " \t\r\n") == strlen(line);
+        if (empty && job_count > 0) {
+            bool succeeded = render_scene_jobs(jobs, job_count);
+            printf(succeeded ? "Rendered %d jobs.\n"
+                             : "Cannot render all of %d jobs.\n",
+                   job_count);
+            fflush(stdout);
+            job_count = 0;
+        }
+        if (ended) {
+            break;
+        }
+        if (empty) {
+            continue;
+        }
+        if (job_count + scale_count > job_capacity) {
+            int capacity = job_capacity > 0 ? 2 * job_capacity : 8;
+            struct scene_job *grown =
+                realloc(jobs, sizeof(struct scene_job) * (size_t)capacity);
+            if (grown == NULL) {
+                printf("Cannot allocate memory for the job list.\n");
+                continue;
+            }
+            jobs = grown;
+            job_capacity = capacity;
+        }
+        if (parse_job(line, jobs + job_count, scales, scale_count, cache,
+                      unlit_shadow_map)) {
+            job_count += scale_count;
+        } else {
+            fflush(stdout);
+        }
+    }
+    free(jobs);
+}
+
+// Renders the scene files as one batch of jobs, with the jobs of every
+// preview scale before those of the next.
+static void render_scene_files(char **paths, int count,
+                               struct asset_cache *cache,
+                               struct texture *unlit_shadow_map) {
+    // All scenes are opened before any is rendered, so that the workers share
+    // the assets that were loaded once in this process, and the frames of all
+    // scenes go to one pool of workers.
+    int scales[MAX_PREVIEW_SCALES];
+    int scale_count = get_preview_scales(scales);
+    int job_count = count * scale_count;
+    struct scene_job *jobs =
+        malloc(sizeof(struct scene_job) * (size_t)job_count);
+    if (jobs == NULL) {
+        printf("Cannot allocate memory for the job list.\n");
+        return;
+    }
+    int opened = 0;
+    while (opened < job_count &&
+           open_scene_job(jobs + opened, paths[opened % count], -1, -1, -1,
+                          scales[opened / count], cache, unlit_shadow_map)) {
+        opened++;
+    }
+    if (opened == job_count) {
+        if (!render_scene_jobs(jobs, job_count)) {
+            printf("Cannot render all scenes.\n");
+        }
+    } else {
+        for (int i = 0; i < opened; i++) {
+            close_scene_job(&jobs[i]);
+        }
+    }
+    free(jobs);
+}
+
+// Loads the scene files and runs the benchmark or the check on them. Returns
+// false if a scene cannot be loaded or the run fails.
+static bool run_on_scene_files(char **paths, int count,
+                               struct asset_cache *cache,
+                               struct texture *unlit_shadow_map,
+                               bool (*run)(const struct scene_context *contexts,
+                                           int count)) {
+    // One more so that an empty scene list does not allocate zero bytes.
+    struct scene **scenes = calloc((size_t)count + 1, sizeof(struct scene *));
+    struct scene_context *contexts =
+        calloc((size_t)count + 1, sizeof(struct scene_context));
+    int loaded = 0;
+    bool succeeded = false;
+    if (scenes == NULL || contexts == NULL) {
+        printf("Cannot allocate memory for the scene list.\n");
+    } else {
+        for (; loaded < count; loaded++) {
+            scenes[loaded] = load_scene(paths[loaded], cache);
+            if (scenes[loaded] == NULL) {
+                break;
+            }
+            contexts[loaded].scene = scenes[loaded];
+            contexts[loaded].unlit_shadow_map = unlit_shadow_map;
+        }
+        succeeded = loaded == count && run(contexts, count);
+    }
+    for (int i = 0; i < loaded; i++) {
+        destroy_scene(scenes[i]);
+    }
+    free(scenes);
+    free(contexts);
+    return succeeded;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s <scene file>...\n"
+               "       %s - < <job list>\n"
+               "       %s --bench <scene file>...\n"
+               "       %s --check <scene file>...\n",
+               argv[0], argv[0], argv[0], argv[0]);
+        return 0;
+    }
+    // Benchmarks and checks measure themselves, so they are never profiled.
+    bool benchmark = strcmp(argv[1], "--bench") == 0;
+    bool check = strcmp(argv[1], "--check") == 0;
+    if (!benchmark && !check && !open_profile()) {
+        return 0;
+    }
+    struct asset_cache *cache = create_asset_cache();
+    struct texture *unlit_shadow_map =
+        create_texture(TEXTURE_FORMAT_DEPTH_FLOAT, 1, 1);
+    if (cache == NULL || unlit_shadow_map == NULL) {
+        printf("Cannot allocate memory.\n");
+        destroy_asset_cache(cache);
+        destroy_texture(unlit_shadow_map);
+        close_profile();
+        return 0;
+    }
+    float shadow_value = 1.0f;
+    set_texture_pixels(unlit_shadow_map, &shadow_value);
+
+    // Only a failed check exits with an error, so that a script can run it.
+    int status = 0;
+    if (benchmark) {
+        if (!run_on_scene_files(argv + 2, argc - 2, cache, unlit_shadow_map,
+                                run_benchmark)) {
+            printf("Cannot finish the benchmark.\n");
+        }
+    } else if (check) {
+        if (!run_on_scene_files(argv + 2, argc - 2, cache, unlit_shadow_map,
+                                run_check)) {
+            status = 1;
+        }
+    } else if (argc == 2 && strcmp(argv[1], "-") == 0) {
+        serve_jobs(cache, unlit_shadow_map);
+    } else {
+        render_scene_files(argv + 1, argc - 1, cache, unlit_shadow_map);
+    }
+
+    destroy_texture(unlit_shadow_map);
+    destroy_asset_cache(cache);
+    close_profile();
+    return status;
+}
@@ -0,0 +1,145 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#include "asset_cache.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graphics/texture.h"
+
+#include "baked_mesh.h"
+#include "mip_chain.h"
+
+// Scenes use a handful of assets, so a list is searched linearly.
+struct cached_asset {
+    struct cached_asset *next;
+    // NULL for constant images.
+    char *path;
+    // The asset is a mesh if it is not NULL, otherwise an image.
+    struct baked_mesh *mesh;
+    struct mip_chain *image;
+    bool srgb;
+    // The format and pixel of constant images.
+    enum texture_format format;
+    uint8_t pixel[4];
+};
+
+struct asset_cache {
+    struct cached_asset *assets;
+};
+
+struct asset_cache *create_asset_cache(void) {
+    return calloc(1, sizeof(struct asset_cache));
+}
+
+void destroy_asset_cache(struct asset_cache *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    struct cached_asset *asset = cache->assets;
+    while (asset != NULL) {
+        struct cached_asset *next = asset->next;
+        destroy_baked_mesh(asset->mesh);
+        destroy_mip_chain(asset->image);
+        free(asset->path);
+        free(asset);
+        asset = next;
+    }
+    free(cache);
+}
+
+static struct cached_asset *add_asset(struct asset_cache *cache,
+                                      const char *path) {
+    struct cached_asset *asset = calloc(1, sizeof(struct cached_asset));
+    if (asset == NULL) {
+        return NULL;
+    }
+    if (path != NULL) {
+        size_t size = strlen(path) + 1;
+        asset->path = malloc(size);
+        if (asset->path == NULL) {
+            free(asset);
+            return NULL;
+        }
+        memcpy(asset->path, path, size);
+    }
+    asset->next = cache->assets;
+    cache->assets = asset;
+    return asset;
+}
+
+const struct baked_mesh *get_cached_mesh(struct asset_cache *cache,
+                                         const char *path) {
+    for (struct cached_asset *asset = cache->assets; asset != NULL;
+         asset = asset->next) {
+        if (asset->mesh != NULL && asset->path != NULL &&
+            strcmp(asset->path, path) == 0) {
+            return asset->mesh;
+        }
+    }
+    struct baked_mesh *mesh = load_baked_mesh(path);
+    if (mesh == NULL) {
+        return NULL;
+    }
+    struct cached_asset *asset = add_asset(cache, path);
+    if (asset == NULL) {
+        destroy_baked_mesh(mesh);
+        return NULL;
+    }
+    asset->mesh = mesh;
+    return mesh;
+}
+
+const struct mip_chain *get_cached_image(struct asset_cache *cache,
+                                         const char *path, bool srgb) {
+    for (struct cached_asset *asset = cache->assets; asset != NULL;
+         asset = asset->next) {
+        if (asset->image != NULL && asset->path != NULL &&
+            asset->srgb == srgb && strcmp(asset->path, path) == 0) {
+            return asset->image;
+        }
+    }
+    struct mip_chain *image = load_mip_chain(path, srgb);
+    if (image == NULL) {
+        return NULL;
+    }
+    struct cached_asset *asset = add_asset(cache, path);
+    if (asset == NULL) {
+        destroy_mip_chain(image);
+        return NULL;
+    }
+    asset->image = image;
+    asset->srgb = srgb;
+    return image;
+}
+
+const struct mip_chain *get_constant_image(struct asset_cache *cache,
+                                           enum texture_format format,
+                                           const uint8_t pixel[4]) {
+    for (struct cached_asset *asset = cache->assets; asset != NULL;
+         asset = asset->next) {
+        if (asset->image != NULL && asset->path == NULL &&
+            asset->format == format && memcmp(asset->pixel, pixel, 4) == 0) {
+            return asset->image;
+        }
+    }
+    struct mip_chain *image = create_constant_mip_chain(format, pixel);
+    if (image == NULL) {
+        return NULL;
+    }
+    struct cached_asset *asset = add_asset(cache, NULL);
+    if (asset == NULL) {
+        destroy_mip_chain(image);
+        return NULL;
+    }
+    asset->image = image;
+    asset->format = format;
+    memcpy(asset->pixel, pixel, 4);
+    return image;
+}
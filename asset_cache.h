@@ -0,0 +1,44 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#ifndef ASSET_CACHE_H_
+#define ASSET_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "graphics/texture.h"
+
+#include "baked_mesh.h"
+#include "mip_chain.h"
+
+// Loads every mesh and image once, however many scenes use it, and keeps it
+// until the cache is destroyed.
+struct asset_cache;
+
+// Returns NULL if the memory cannot be allocated.
+struct asset_cache *create_asset_cache(void);
+
+// Destroys the cache and every asset it loaded.
+void destroy_asset_cache(struct asset_cache *cache);
+
+// Returns the baked mesh of an .obj file, loading it with load_baked_mesh() the
+// first time. Returns NULL if the mesh cannot be loaded.
+const struct baked_mesh *get_cached_mesh(struct asset_cache *cache,
+                                         const char *path);
+
+// Returns the mip chain of an image, loading it with load_mip_chain() the
+// first time it is asked for in this color space. Returns NULL if the image
+// cannot be loaded.
+const struct mip_chain *get_cached_image(struct asset_cache *cache,
+                                         const char *path, bool srgb);
+
+// Returns a 1x1 image of the format with the given pixel, of which an R8
+// image only uses the first byte. Returns NULL if it cannot be created.
+const struct mip_chain *get_constant_image(struct asset_cache *cache,
+                                           enum texture_format format,
+                                           const uint8_t pixel[4]);
+
+#endif  // ASSET_CACHE_H_
@@ -0,0 +1,1506 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "baked_mesh.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graphics/framebuffer.h"
+#include "graphics/rasterizer.h"
+#include "math/matrix.h"
+#include "math/vector.h"
+#include "shaders/standard.h"
+#include "utilities/mesh.h"
+
+#include "frame_arena.h"
+#include "position_batch.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#else
+#define HAS_MMAP 0
+#endif
+
+#define CACHE_LINE_SIZE 64
+#define EMPTY_SLOT UINT32_MAX
+
+#define BAKED_MESH_FILE_MAGIC "FRBAKED"
+#define BAKED_MESH_FILE_VERSION 4
+#define BAKED_MESH_FILE_SUFFIX ".baked"
+
+// Layout of a baked mesh file: one level of detail after another, from the
+// mesh itself to the coarsest. Every level is this header padded to a cache
+// line, the unique vertices, the indices, the meshlets, then the vertex
+// indices of the meshlets, padded to a cache line again so that the vertices
+// of the next level are aligned. Everything is stored in the byte order and
+// struct layout of the machine that wrote it; files from another build are
+// recognized by the vertex size and rebaked.
+struct baked_mesh_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t vertex_size;
+    uint32_t triangle_count;
+    uint32_t vertex_count;
+    uint32_t meshlet_count;
+    uint32_t meshlet_vertex_count;
+    float center[3];
+    float radius;
+    float texcoord_density;
+    float lod_error;
+    // The levels in the file, only set in the header of the first one.
+    uint32_t level_count;
+};
+
+_Static_assert(sizeof(struct baked_mesh_file_header) <= CACHE_LINE_SIZE,
+               "The header must fit in front of the vertices.");
+
+static size_t round_up_to_cache_line(size_t size) {
+    return (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
+static void *allocate_aligned(size_t size) {
+    // aligned_alloc() requires the size to be a multiple of the alignment.
+    return aligned_alloc(CACHE_LINE_SIZE, round_up_to_cache_line(size));
+}
+
+// FNV-1a over the bytes of the vertex. Two vertices are only merged if they
+// are bitwise identical, so hashing the bytes is consistent with equality.
+static uint32_t hash_vertex(const struct standard_vertex_attribute *vertex) {
+    const uint8_t *bytes = (const uint8_t *)vertex;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(struct standard_vertex_attribute); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Compacts the unique vertices to the front of the array and fills in the
+// index of every corner. Returns the number of unique vertices, or 0 if the
+// hash table cannot be allocated.
+static uint32_t remove_duplicated_vertices(
+    struct standard_vertex_attribute *vertices, uint32_t corner_count,
+    uint32_t *indices) {
+    size_t slot_count = 1;
+    while (slot_count < (size_t)corner_count * 2) {
+        slot_count *= 2;
+    }
+    uint32_t *slots = malloc(sizeof(uint32_t) * slot_count);
+    if (slots == NULL) {
+        return 0;
+    }
+    memset(slots, 0xff, sizeof(uint32_t) * slot_count);
+    size_t mask = slot_count - 1;
+    uint32_t vertex_count = 0;
+    for (uint32_t i = 0; i < corner_count; i++) {
+        size_t slot = hash_vertex(vertices + i) & mask;
+        while (slots[slot] != EMPTY_SLOT &&
+               memcmp(vertices + slots[slot], vertices + i,
+                      sizeof(struct standard_vertex_attribute)) != 0) {
+            slot = (slot + 1) & mask;
+        }
+        if (slots[slot] == EMPTY_SLOT) {
+            // The unique vertices never overtake the corner being visited.
+            vertices[vertex_count] = vertices[i];
+            slots[slot] = vertex_count++;
+        }
+        indices[i] = slots[slot];
+    }
+    free(slots);
+    return vertex_count;
+}
+
+static void compute_bounding_sphere(struct baked_mesh *mesh) {
+    vector3 min = mesh->vertices[0].position;
+    vector3 max = min;
+    for (uint32_t i = 1; i < mesh->vertex_count; i++) {
+        vector3 position = mesh->vertices[i].position;
+        for (int e = 0; e < 3; e++) {
+            min.elements[e] = fminf(min.elements[e], position.elements[e]);
+            max.elements[e] = fmaxf(max.elements[e], position.elements[e]);
+        }
+    }
+    mesh->center = vector3_multiply_scalar(vector3_add(min, max), 0.5f);
+    mesh->radius = 0.0f;
+    for (uint32_t i = 0; i < mesh->vertex_count; i++) {
+        vector3 offset =
+            vector3_subtract(mesh->vertices[i].position, mesh->center);
+        mesh->radius = fmaxf(mesh->radius, vector3_length(offset));
+    }
+}
+
+static void compute_texcoord_density(struct baked_mesh *mesh) {
+    double surface_area = 0.0;
+    double texcoord_area = 0.0;
+    const uint32_t *indices = mesh->indices;
+    for (uint32_t t = 0; t < mesh->triangle_count; t++, indices += 3) {
+        const struct standard_vertex_attribute *a = mesh->vertices + indices[0];
+        const struct standard_vertex_attribute *b = mesh->vertices + indices[1];
+        const struct standard_vertex_attribute *c = mesh->vertices + indices[2];
+        vector3 cross =
+            vector3_cross(vector3_subtract(b->position, a->position),
+                          vector3_subtract(c->position, a->position));
+        surface_area += vector3_length(cross);
+        float u1 = b->texcoord.x - a->texcoord.x;
+        float v1 = b->texcoord.y - a->texcoord.y;
+        float u2 = c->texcoord.x - a->texcoord.x;
+        float v2 = c->texcoord.y - a->texcoord.y;
+        texcoord_area += fabsf(u1 * v2 - v1 * u2);
+    }
+    mesh->texcoord_density =
+        surface_area > 0.0 ? (float)sqrt(texcoord_area / surface_area) : 0.0f;
+}
+
+// Returns the unit normal of the front face of a triangle, or zero if the
+// triangle has no area.
+static vector3 get_face_normal(const struct baked_mesh *mesh,
+                               const uint32_t *triangle) {
+    vector3 a = mesh->vertices[triangle[0]].position;
+    vector3 b = mesh->vertices[triangle[1]].position;
+    vector3 c = mesh->vertices[triangle[2]].position;
+    vector3 cross =
+        vector3_cross(vector3_subtract(b, a), vector3_subtract(c, a));
+    float length = vector3_length(cross);
+    return length > 0.0f ? vector3_multiply_scalar(cross, 1.0f / length)
+                         : VECTOR3_ZERO;
+}
+
+static void compute_meshlet_bounds(const struct baked_mesh *mesh,
+                                   struct meshlet *meshlet) {
+    const uint32_t *vertices = mesh->meshlet_vertices + meshlet->first_vertex;
+    vector3 min = mesh->vertices[vertices[0]].position;
+    vector3 max = min;
+    for (uint32_t i = 1; i < meshlet->vertex_count; i++) {
+        vector3 position = mesh->vertices[vertices[i]].position;
+        for (int e = 0; e < 3; e++) {
+            min.elements[e] = fminf(min.elements[e], position.elements[e]);
+            max.elements[e] = fmaxf(max.elements[e], position.elements[e]);
+        }
+    }
+    meshlet->center = vector3_multiply_scalar(vector3_add(min, max), 0.5f);
+    meshlet->radius = 0.0f;
+    for (uint32_t i = 0; i < meshlet->vertex_count; i++) {
+        vector3 offset = vector3_subtract(mesh->vertices[vertices[i]].position,
+                                          meshlet->center);
+        meshlet->radius = fmaxf(meshlet->radius, vector3_length(offset));
+    }
+
+    // Triangles without area are left out of the cone, since the rasterizer
+    // never draws them.
+    const uint32_t *triangles = mesh->indices + 3 * meshlet->first_triangle;
+    vector3 axis = VECTOR3_ZERO;
+    for (uint32_t t = 0; t < meshlet->triangle_count; t++) {
+        axis = vector3_add(axis, get_face_normal(mesh, triangles + 3 * t));
+    }
+    float length = vector3_length(axis);
+    meshlet->cone_axis =
+        length > 0.0f ? vector3_multiply_scalar(axis, 1.0f / length) : axis;
+    float min_dot = length > 0.0f ? 1.0f : -1.0f;
+    for (uint32_t t = 0; t < meshlet->triangle_count; t++) {
+        vector3 normal = get_face_normal(mesh, triangles + 3 * t);
+        if (vector3_dot(normal, normal) > 0.0f) {
+            min_dot = fminf(min_dot, vector3_dot(normal, meshlet->cone_axis));
+        }
+    }
+    // A cone of more than a hemisphere always has a front face in view.
+    meshlet->cone_cutoff =
+        min_dot > 0.0f ? sqrtf(1.0f - min_dot * min_dot) : 2.0f;
+}
+
+// Lowest cosine between the normal of a triangle and the axis of the meshlet
+// it is added to, which keeps the normal cones narrow enough to cull.
+#define MESHLET_MIN_NORMAL_DOT 0.95f
+
+// State of splitting the triangles of a mesh into meshlets.
+struct meshlet_builder {
+    // Vertices that differ only in attributes other than the position share a
+    // position, which connects triangles across seams.
+    uint32_t *vertex_positions;
+    // The triangles around each position, from triangle_offsets[position] to
+    // triangle_offsets[position + 1] in position_triangles.
+    uint32_t *triangle_offsets;
+    uint32_t *position_triangles;
+    vector3 *normals;
+    uint8_t *added_triangles;
+    // The meshlet each vertex and position was last added to.
+    uint32_t *vertex_meshlets;
+    uint32_t *position_meshlets;
+    // Triangles next to the vertices of the current meshlet, which may have
+    // been added since.
+    uint32_t *candidates;
+    uint32_t candidate_count;
+    // The triangles in the order of the meshlets.
+    uint32_t *indices;
+};
+
+static void destroy_meshlet_builder(struct meshlet_builder *builder) {
+    free(builder->vertex_positions);
+    free(builder->triangle_offsets);
+    free(builder->position_triangles);
+    free(builder->normals);
+    free(builder->added_triangles);
+    free(builder->vertex_meshlets);
+    free(builder->position_meshlets);
+    free(builder->candidates);
+    free(builder->indices);
+}
+
+// Numbers the distinct positions of the vertices. Returns the number of
+// positions, or 0 if the hash table cannot be allocated.
+static uint32_t number_positions(const struct baked_mesh *mesh,
+                                 uint32_t *vertex_positions) {
+    size_t slot_count = 1;
+    while (slot_count < (size_t)mesh->vertex_count * 2) {
+        slot_count *= 2;
+    }
+    uint32_t *slots = malloc(sizeof(uint32_t) * slot_count);
+    if (slots == NULL) {
+        return 0;
+    }
+    memset(slots, 0xff, sizeof(uint32_t) * slot_count);
+    size_t mask = slot_count - 1;
+    uint32_t position_count = 0;
+    for (uint32_t i = 0; i < mesh->vertex_count; i++) {
+        const vector3 *position = &mesh->vertices[i].position;
+        const uint8_t *bytes = (const uint8_t *)position;
+        uint32_t hash = 2166136261u;
+        for (size_t b = 0; b < sizeof(vector3); b++) {
+            hash = (hash ^ bytes[b]) * 16777619u;
+        }
+        size_t slot = hash & mask;
+        while (slots[slot] != EMPTY_SLOT &&
+               memcmp(&mesh->vertices[slots[slot]].position, position,
+                      sizeof(vector3)) != 0) {
+            slot = (slot + 1) & mask;
+        }
+        if (slots[slot] == EMPTY_SLOT) {
+            slots[slot] = i;
+            vertex_positions[i] = position_count++;
+        } else {
+            vertex_positions[i] = vertex_positions[slots[slot]];
+        }
+    }
+    free(slots);
+    return position_count;
+}
+
+static bool create_meshlet_builder(struct meshlet_builder *builder,
+                                   const struct baked_mesh *mesh) {
+    size_t vertex_count = mesh->vertex_count;
+    size_t index_count = 3 * (size_t)mesh->triangle_count;
+    memset(builder, 0, sizeof(struct meshlet_builder));
+    builder->vertex_positions = malloc(sizeof(uint32_t) * (vertex_count + 1));
+    if (builder->vertex_positions == NULL) {
+        return false;
+    }
+    size_t position_count =
+        number_positions(mesh, builder->vertex_positions);
+    if (position_count == 0 && vertex_count != 0) {
+        destroy_meshlet_builder(builder);
+        return false;
+    }
+    builder->triangle_offsets = calloc(position_count + 2, sizeof(uint32_t));
+    builder->position_triangles =
+        malloc(sizeof(uint32_t) * (index_count + 1));
+    builder->normals =
+        malloc(sizeof(vector3) * ((size_t)mesh->triangle_count + 1));
+    builder->added_triangles = calloc((size_t)mesh->triangle_count + 1, 1);
+    builder->vertex_meshlets = malloc(sizeof(uint32_t) * (vertex_count + 1));
+    builder->position_meshlets =
+        malloc(sizeof(uint32_t) * (position_count + 1));
+    builder->candidates = malloc(sizeof(uint32_t) * (index_count + 1));
+    builder->indices = malloc(sizeof(uint32_t) * (index_count + 1));
+    if (builder->triangle_offsets == NULL ||
+        builder->position_triangles == NULL || builder->normals == NULL ||
+        builder->added_triangles == NULL ||
+        builder->vertex_meshlets == NULL ||
+        builder->position_meshlets == NULL || builder->candidates == NULL ||
+        builder->indices == NULL) {
+        destroy_meshlet_builder(builder);
+        return false;
+    }
+    // Counts the triangles around each position one slot ahead, so that the
+    // prefix sum ends up starting each range, then fills the ranges while
+    // moving the offsets forward by one slot.
+    uint32_t *offsets = builder->triangle_offsets;
+    for (size_t i = 0; i < index_count; i++) {
+        offsets[builder->vertex_positions[mesh->indices[i]] + 2]++;
+    }
+    for (size_t p = 2; p < position_count + 2; p++) {
+        offsets[p] += offsets[p - 1];
+    }
+    for (size_t i = 0; i < index_count; i++) {
+        uint32_t position = builder->vertex_positions[mesh->indices[i]];
+        builder->position_triangles[offsets[position + 1]++] =
+            (uint32_t)(i / 3);
+    }
+    for (uint32_t t = 0; t < mesh->triangle_count; t++) {
+        builder->normals[t] =
+            get_face_normal(mesh, mesh->indices + 3 * (size_t)t);
+    }
+    memset(builder->vertex_meshlets, 0xff, sizeof(uint32_t) * vertex_count);
+    memset(builder->position_meshlets, 0xff,
+           sizeof(uint32_t) * position_count);
+    return true;
+}
+
+// Adds a triangle to the last meshlet of the mesh.
+static void add_meshlet_triangle(struct meshlet_builder *builder,
+                                 struct baked_mesh *mesh, uint32_t triangle) {
+    uint32_t current = mesh->meshlet_count - 1;
+    struct meshlet *meshlet = mesh->meshlets + current;
+    const uint32_t *vertices = mesh->indices + 3 * (size_t)triangle;
+    for (int v = 0; v < 3; v++) {
+        uint32_t vertex = vertices[v];
+        if (builder->vertex_meshlets[vertex] == current) {
+            continue;
+        }
+        builder->vertex_meshlets[vertex] = current;
+        mesh->meshlet_vertices[mesh->meshlet_vertex_count++] = vertex;
+        meshlet->vertex_count++;
+        uint32_t position = builder->vertex_positions[vertex];
+        if (builder->position_meshlets[position] == current) {
+            continue;
+        }
+        builder->position_meshlets[position] = current;
+        for (uint32_t i = builder->triangle_offsets[position];
+             i < builder->triangle_offsets[position + 1]; i++) {
+            uint32_t candidate = builder->position_triangles[i];
+            if (!builder->added_triangles[candidate]) {
+                builder->candidates[builder->candidate_count++] = candidate;
+            }
+        }
+    }
+    builder->added_triangles[triangle] = 1;
+    memcpy(builder->indices + 3 * (size_t)(meshlet->first_triangle +
+                                           meshlet->triangle_count),
+           vertices, sizeof(uint32_t) * 3);
+    meshlet->triangle_count++;
+}
+
+// Returns the candidate that adds the fewest vertices to the last meshlet and
+// then has the normal closest to its axis, or UINT32_MAX if no candidate
+// fits. Candidates that have been added are dropped.
+static uint32_t find_meshlet_triangle(struct meshlet_builder *builder,
+                                      const struct baked_mesh *mesh,
+                                      vector3 axis) {
+    uint32_t current = mesh->meshlet_count - 1;
+    const struct meshlet *meshlet = mesh->meshlets + current;
+    uint32_t best = UINT32_MAX;
+    uint32_t best_vertex_count = 4;
+    float best_dot = -2.0f;
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < builder->candidate_count; i++) {
+        uint32_t candidate = builder->candidates[i];
+        if (builder->added_triangles[candidate]) {
+            continue;
+        }
+        builder->candidates[kept++] = candidate;
+        const uint32_t *vertices = mesh->indices + 3 * (size_t)candidate;
+        uint32_t new_vertex_count = 0;
+        for (int v = 0; v < 3; v++) {
+            new_vertex_count +=
+                builder->vertex_meshlets[vertices[v]] != current;
+        }
+        float dot = vector3_dot(builder->normals[candidate], axis);
+        if (meshlet->vertex_count + new_vertex_count >
+                MESHLET_MAX_VERTEX_COUNT ||
+            dot < MESHLET_MIN_NORMAL_DOT) {
+            continue;
+        }
+        if (new_vertex_count < best_vertex_count ||
+            (new_vertex_count == best_vertex_count && dot > best_dot)) {
+            best = candidate;
+            best_vertex_count = new_vertex_count;
+            best_dot = dot;
+        }
+    }
+    builder->candidate_count = kept;
+    return best;
+}
+
+// Splits the triangles into meshlets and reorders them so that every meshlet
+// is a run of consecutive triangles. Each meshlet grows from a seed triangle
+// over the triangles that share its vertices and face about the same way,
+// until one more would exceed a limit. The next seed is a triangle next to
+// the last meshlet if there is one left. Reordering only changes which of two
+// equally deep fragments is drawn. Returns false if the memory cannot be
+// allocated.
+static bool build_meshlets(struct baked_mesh *mesh) {
+    uint32_t triangle_count = mesh->triangle_count;
+    struct meshlet_builder builder;
+    mesh->meshlets =
+        malloc(sizeof(struct meshlet) * ((size_t)triangle_count + 1));
+    mesh->meshlet_vertices =
+        malloc(sizeof(uint32_t) * (3 * (size_t)triangle_count + 1));
+    if (mesh->meshlets == NULL || mesh->meshlet_vertices == NULL ||
+        !create_meshlet_builder(&builder, mesh)) {
+        return false;
+    }
+    uint32_t next_seed = 0;
+    uint32_t added_count = 0;
+    while (added_count < triangle_count) {
+        uint32_t seed = UINT32_MAX;
+        for (uint32_t i = 0; i < builder.candidate_count; i++) {
+            if (!builder.added_triangles[builder.candidates[i]]) {
+                seed = builder.candidates[i];
+                break;
+            }
+        }
+        while (seed == UINT32_MAX) {
+            if (!builder.added_triangles[next_seed]) {
+                seed = next_seed;
+            }
+            next_seed++;
+        }
+        struct meshlet *meshlet = mesh->meshlets + mesh->meshlet_count++;
+        meshlet->first_triangle = added_count;
+        meshlet->triangle_count = 0;
+        meshlet->first_vertex = mesh->meshlet_vertex_count;
+        meshlet->vertex_count = 0;
+        builder.candidate_count = 0;
+        vector3 normal_sum = VECTOR3_ZERO;
+        uint32_t triangle = seed;
+        while (triangle != UINT32_MAX) {
+            add_meshlet_triangle(&builder, mesh, triangle);
+            normal_sum = vector3_add(normal_sum, builder.normals[triangle]);
+            if (meshlet->triangle_count == MESHLET_MAX_TRIANGLE_COUNT) {
+                break;
+            }
+            float length = vector3_length(normal_sum);
+            vector3 axis = length > 0.0f
+                               ? vector3_multiply_scalar(normal_sum,
+                                                         1.0f / length)
+                               : normal_sum;
+            triangle = find_meshlet_triangle(&builder, mesh, axis);
+        }
+        added_count += meshlet->triangle_count;
+    }
+    free(mesh->indices);
+    mesh->indices = builder.indices;
+    builder.indices = NULL;
+    destroy_meshlet_builder(&builder);
+    for (uint32_t i = 0; i < mesh->meshlet_count; i++) {
+        compute_meshlet_bounds(mesh, mesh->meshlets + i);
+    }
+    // Shrinking never fails in practice, and the arrays stay valid if it does.
+    struct meshlet *meshlets = realloc(
+        mesh->meshlets, sizeof(struct meshlet) * (mesh->meshlet_count + 1));
+    if (meshlets != NULL) {
+        mesh->meshlets = meshlets;
+    }
+    uint32_t *meshlet_vertices =
+        realloc(mesh->meshlet_vertices,
+                sizeof(uint32_t) * (mesh->meshlet_vertex_count + 1));
+    if (meshlet_vertices != NULL) {
+        mesh->meshlet_vertices = meshlet_vertices;
+    }
+    return true;
+}
+
+// Fills in the vertices and triangles of the mesh from the attributes of the
+// corners of its triangles, three per triangle, which are overwritten, and
+// splits the triangles into meshlets. Returns false if the memory cannot be
+// allocated.
+static bool bake_corners(struct baked_mesh *baked,
+                         struct standard_vertex_attribute *corners,
+                         uint32_t triangle_count) {
+    uint32_t corner_count = triangle_count * 3;
+    baked->indices = malloc(sizeof(uint32_t) * corner_count);
+    if (baked->indices == NULL) {
+        return false;
+    }
+    uint32_t vertex_count =
+        remove_duplicated_vertices(corners, corner_count, baked->indices);
+    if (vertex_count == 0 && corner_count != 0) {
+        return false;
+    }
+    size_t size = sizeof(struct standard_vertex_attribute) * vertex_count;
+    baked->vertices = allocate_aligned(size);
+    if (baked->vertices == NULL) {
+        return false;
+    }
+    memcpy(baked->vertices, corners, size);
+    baked->triangle_count = triangle_count;
+    baked->vertex_count = vertex_count;
+    if (vertex_count > 0) {
+        compute_bounding_sphere(baked);
+    }
+    compute_texcoord_density(baked);
+    return build_meshlets(baked);
+}
+
+struct baked_mesh *bake_mesh(const struct mesh *mesh) {
+    uint32_t triangle_count = mesh->triangle_count;
+    uint32_t corner_count = triangle_count * 3;
+    struct baked_mesh *baked = calloc(1, sizeof(struct baked_mesh));
+    struct standard_vertex_attribute *corners =
+        malloc(sizeof(struct standard_vertex_attribute) * corner_count);
+    if (baked == NULL || corners == NULL) {
+        goto error;
+    }
+    struct standard_vertex_attribute *vertex = corners;
+    for (uint32_t t = 0; t < triangle_count; t++) {
+        for (uint32_t v = 0; v < 3; v++, vertex++) {
+            get_mesh_position(&vertex->position, mesh, t, v);
+            get_mesh_normal(&vertex->normal, mesh, t, v);
+            get_mesh_tangent(&vertex->tangent, mesh, t, v);
+            get_mesh_texcoord(&vertex->texcoord, mesh, t, v);
+        }
+    }
+    if (!bake_corners(baked, corners, triangle_count)) {
+        goto error;
+    }
+    free(corners);
+    return baked;
+
+error:
+    free(corners);
+    destroy_baked_mesh(baked);
+    return NULL;
+}
+
+void destroy_baked_mesh(struct baked_mesh *mesh) {
+    if (mesh == NULL) {
+        return;
+    }
+    destroy_baked_mesh(mesh->coarser);
+#if HAS_MMAP
+    if (mesh->mapping != NULL) {
+        // The levels of detail share the mapping of the mesh.
+        if (mesh->mapping_size > 0) {
+            munmap(mesh->mapping, mesh->mapping_size);
+        }
+        free(mesh);
+        return;
+    }
+#endif
+    free(mesh->vertices);
+    free(mesh->indices);
+    free(mesh->meshlets);
+    free(mesh->meshlet_vertices);
+    free(mesh);
+}
+
+// Levels of detail are simplified by vertex clustering: the positions are
+// snapped to a grid, every vertex moves to the mean position of the vertices
+// in its cell, and the triangles that lose their area or repeat another one
+// are dropped. The other attributes of the vertices are kept, so the texture
+// seams stay where they are. Every level is simplified from the full mesh, so
+// its error is the diagonal of its cells.
+
+// The finest and the coarsest grid, in cells across the bounding sphere.
+#define LOD_MAX_GRID_SIZE 512
+#define LOD_MIN_GRID_SIZE 8
+// A level is skipped for a coarser grid unless it has at most this fraction
+// of the triangles of the level before it.
+#define LOD_MAX_TRIANGLE_RATIO 0.5f
+// Levels with fewer triangles are not simplified further.
+#define LOD_MIN_TRIANGLE_COUNT 256
+
+static uint32_t hash_uint32(uint32_t value) {
+    value ^= value >> 16;
+    value *= 0x7feb352du;
+    value ^= value >> 15;
+    value *= 0x846ca68bu;
+    value ^= value >> 16;
+    return value;
+}
+
+static size_t get_slot_count(size_t count) {
+    size_t slot_count = 1;
+    while (slot_count < count * 2) {
+        slot_count *= 2;
+    }
+    return slot_count;
+}
+
+// Finds the grid cell of every vertex and numbers the cells that have any.
+// Fills in the cluster of every vertex and the mean position of the vertices
+// of every cluster. Returns the number of clusters, or 0 if the memory cannot
+// be allocated.
+static uint32_t cluster_vertices(const struct baked_mesh *mesh,
+                                 uint32_t grid_size,
+                                 uint32_t *vertex_clusters,
+                                 vector3 *positions) {
+    size_t slot_count = get_slot_count(mesh->vertex_count);
+    uint32_t *slots = malloc(sizeof(uint32_t) * slot_count);
+    uint32_t *keys = malloc(sizeof(uint32_t) * (mesh->vertex_count + 1));
+    uint32_t *counts = malloc(sizeof(uint32_t) * (mesh->vertex_count + 1));
+    if (slots == NULL || keys == NULL || counts == NULL) {
+        free(slots);
+        free(keys);
+        free(counts);
+        return 0;
+    }
+    memset(slots, 0xff, sizeof(uint32_t) * slot_count);
+    size_t mask = slot_count - 1;
+    float cells_per_unit = grid_size / (2.0f * mesh->radius);
+    uint32_t cluster_count = 0;
+    for (uint32_t i = 0; i < mesh->vertex_count; i++) {
+        vector3 position = mesh->vertices[i].position;
+        uint32_t key = 0;
+        for (int e = 2; e >= 0; e--) {
+            float offset = position.elements[e] - mesh->center.elements[e] +
+                           mesh->radius;
+            int cell = (int)(offset * cells_per_unit);
+            cell = cell < 0 ? 0 : cell;
+            cell = cell >= (int)grid_size ? (int)grid_size - 1 : cell;
+            key = key * grid_size + (uint32_t)cell;
+        }
+        size_t slot = hash_uint32(key) & mask;
+        while (slots[slot] != EMPTY_SLOT && keys[slots[slot]] != key) {
+            slot = (slot + 1) & mask;
+        }
+        if (slots[slot] == EMPTY_SLOT) {
+            keys[cluster_count] = key;
+            counts[cluster_count] = 0;
+            positions[cluster_count] = VECTOR3_ZERO;
+            slots[slot] = cluster_count++;
+        }
+        uint32_t cluster = slots[slot];
+        vertex_clusters[i] = cluster;
+        positions[cluster] = vector3_add(positions[cluster], position);
+        counts[cluster]++;
+    }
+    for (uint32_t c = 0; c < cluster_count; c++) {
+        positions[c] = vector3_multiply_scalar(positions[c], 1.0f / counts[c]);
+    }
+    free(slots);
+    free(keys);
+    free(counts);
+    return cluster_count;
+}
+
+// Returns the triangles of the mesh between the clusters, without the ones
+// that have two corners in the same cluster and without repeats. The triangle
+// with the same clusters in the same winding order is a repeat. Returns the
+// number of triangles, or UINT32_MAX if the memory cannot be allocated.
+static uint32_t get_clustered_triangles(const struct baked_mesh *mesh,
+                                        const uint32_t *vertex_clusters,
+                                        uint32_t *triangles) {
+    size_t slot_count = get_slot_count(mesh->triangle_count);
+    uint32_t *slots = malloc(sizeof(uint32_t) * slot_count);
+    uint32_t *clusters =
+        malloc(sizeof(uint32_t) * (3 * (size_t)mesh->triangle_count + 1));
+    if (slots == NULL || clusters == NULL) {
+        free(slots);
+        free(clusters);
+        return UINT32_MAX;
+    }
+    memset(slots, 0xff, sizeof(uint32_t) * slot_count);
+    size_t mask = slot_count - 1;
+    uint32_t kept_count = 0;
+    for (uint32_t t = 0; t < mesh->triangle_count; t++) {
+        const uint32_t *indices = mesh->indices + 3 * (size_t)t;
+        uint32_t corners[3] = {vertex_clusters[indices[0]],
+                               vertex_clusters[indices[1]],
+                               vertex_clusters[indices[2]]};
+        if (corners[0] == corners[1] || corners[1] == corners[2] ||
+            corners[2] == corners[0]) {
+            continue;
+        }
+        // Start at the smallest cluster, which keeps the winding order.
+        int first = 0;
+        for (int v = 1; v < 3; v++) {
+            if (corners[v] < corners[first]) {
+                first = v;
+            }
+        }
+        uint32_t *kept = clusters + 3 * (size_t)kept_count;
+        for (int v = 0; v < 3; v++) {
+            kept[v] = corners[(first + v) % 3];
+        }
+        uint32_t hash =
+            hash_uint32(kept[0] ^ hash_uint32(kept[1] ^ hash_uint32(kept[2])));
+        size_t slot = hash & mask;
+        while (slots[slot] != EMPTY_SLOT &&
+               memcmp(clusters + 3 * (size_t)slots[slot], kept,
+                      sizeof(uint32_t) * 3) != 0) {
+            slot = (slot + 1) & mask;
+        }
+        if (slots[slot] == EMPTY_SLOT) {
+            slots[slot] = kept_count;
+            triangles[kept_count++] = t;
+        }
+    }
+    free(slots);
+    free(clusters);
+    return kept_count;
+}
+
+// Returns the mesh simplified on a grid of grid_size cells across its
+// bounding sphere, with meshlets, or NULL if the memory cannot be allocated.
+static struct baked_mesh *simplify_mesh(const struct baked_mesh *mesh,
+                                        uint32_t grid_size) {
+    struct baked_mesh *lod = calloc(1, sizeof(struct baked_mesh));
+    uint32_t *vertex_clusters =
+        malloc(sizeof(uint32_t) * (mesh->vertex_count + 1));
+    vector3 *positions = malloc(sizeof(vector3) * (mesh->vertex_count + 1));
+    uint32_t *triangles =
+        malloc(sizeof(uint32_t) * (mesh->triangle_count + 1));
+    struct standard_vertex_attribute *corners =
+        malloc(sizeof(struct standard_vertex_attribute) *
+               (3 * (size_t)mesh->triangle_count + 1));
+    if (lod == NULL || vertex_clusters == NULL || positions == NULL ||
+        triangles == NULL || corners == NULL ||
+        cluster_vertices(mesh, grid_size, vertex_clusters, positions) == 0) {
+        goto error;
+    }
+    uint32_t triangle_count =
+        get_clustered_triangles(mesh, vertex_clusters, triangles);
+    if (triangle_count == UINT32_MAX) {
+        goto error;
+    }
+    struct standard_vertex_attribute *corner = corners;
+    for (uint32_t t = 0; t < triangle_count; t++) {
+        const uint32_t *indices = mesh->indices + 3 * (size_t)triangles[t];
+        for (int v = 0; v < 3; v++, corner++) {
+            *corner = mesh->vertices[indices[v]];
+            corner->position = positions[vertex_clusters[indices[v]]];
+        }
+    }
+    // An empty level is returned without arrays, to be skipped.
+    if (triangle_count > 0 && !bake_corners(lod, corners, triangle_count)) {
+        goto error;
+    }
+    // Keep the mip levels of the textures the same on all levels.
+    lod->texcoord_density = mesh->texcoord_density;
+    lod->lod_error = sqrtf(3.0f) * 2.0f * mesh->radius / grid_size;
+    free(vertex_clusters);
+    free(positions);
+    free(triangles);
+    free(corners);
+    return lod;
+
+error:
+    free(vertex_clusters);
+    free(positions);
+    free(triangles);
+    free(corners);
+    destroy_baked_mesh(lod);
+    return NULL;
+}
+
+// Builds the levels of detail of the mesh, from the finest grid to the
+// coarsest. Returns false if the memory cannot be allocated, in which case the
+// mesh keeps the levels built so far.
+static bool build_mesh_lods(struct baked_mesh *mesh) {
+    if (mesh->radius <= 0.0f) {
+        return true;
+    }
+    struct baked_mesh *last = mesh;
+    for (uint32_t grid_size = LOD_MAX_GRID_SIZE;
+         grid_size >= LOD_MIN_GRID_SIZE &&
+         last->triangle_count >= LOD_MIN_TRIANGLE_COUNT;
+         grid_size /= 2) {
+        struct baked_mesh *lod = simplify_mesh(mesh, grid_size);
+        if (lod == NULL) {
+            return false;
+        }
+        if (lod->triangle_count == 0 ||
+            lod->triangle_count >
+                LOD_MAX_TRIANGLE_RATIO * last->triangle_count) {
+            destroy_baked_mesh(lod);
+            continue;
+        }
+        last->coarser = lod;
+        last = lod;
+    }
+    return true;
+}
+
+const struct baked_mesh *select_mesh_lod(const struct baked_mesh *mesh,
+                                         matrix4x4 local2clip, uint32_t width,
+                                         uint32_t height, float max_error) {
+    if (mesh->coarser == NULL || max_error <= 0.0f) {
+        return mesh;
+    }
+    // An offset in local space moves a vertex on the screen by at most its
+    // length times the length of the x or y row of local2clip over w, if the
+    // change of w is ignored.
+    float row_lengths[4];
+    for (int r = 0; r < 4; r++) {
+        vector3 row = {{local2clip.elements[r][0], local2clip.elements[r][1],
+                        local2clip.elements[r][2]}};
+        row_lengths[r] = vector3_length(row);
+    }
+    float nearest_w = local2clip.elements[3][3] -
+                      mesh->radius * row_lengths[3];
+    for (int c = 0; c < 3; c++) {
+        nearest_w += local2clip.elements[3][c] * mesh->center.elements[c];
+    }
+    if (nearest_w <= 0.0f) {
+        return mesh;
+    }
+    float pixels_per_unit = fmaxf(0.5f * width * row_lengths[0],
+                                  0.5f * height * row_lengths[1]) /
+                            nearest_w;
+    const struct baked_mesh *selected = mesh;
+    for (const struct baked_mesh *lod = mesh->coarser;
+         lod != NULL && lod->lod_error * pixels_per_unit <= max_error;
+         lod = lod->coarser) {
+        selected = lod;
+    }
+    return selected;
+}
+
+#if HAS_MMAP
+// Returns the size of the arrays of a level of a baked mesh file, without
+// the header and the padding after them.
+static size_t get_baked_mesh_array_size(
+    const struct baked_mesh_file_header *header) {
+    return sizeof(struct standard_vertex_attribute) * header->vertex_count +
+           sizeof(uint32_t) * 3 * (size_t)header->triangle_count +
+           sizeof(struct meshlet) * header->meshlet_count +
+           sizeof(uint32_t) * header->meshlet_vertex_count;
+}
+
+// Returns the size of a level of a baked mesh file, including its header and
+// the padding after it.
+static size_t get_baked_mesh_level_size(
+    const struct baked_mesh_file_header *header) {
+    return round_up_to_cache_line(CACHE_LINE_SIZE +
+                                  get_baked_mesh_array_size(header));
+}
+
+// Returns the path of the baked mesh file of an .obj file, which the caller
+// must free, or NULL if the memory cannot be allocated.
+static char *get_baked_mesh_path(const char *obj_path) {
+    size_t length = strlen(obj_path);
+    char *path = malloc(length + sizeof(BAKED_MESH_FILE_SUFFIX));
+    if (path != NULL) {
+        memcpy(path, obj_path, length);
+        memcpy(path + length, BAKED_MESH_FILE_SUFFIX,
+               sizeof(BAKED_MESH_FILE_SUFFIX));
+    }
+    return path;
+}
+
+// Writes one level of a baked mesh file.
+static bool write_baked_mesh_level(const struct baked_mesh *mesh,
+                                   uint32_t level_count, FILE *file) {
+    uint8_t header_bytes[CACHE_LINE_SIZE] = {0};
+    struct baked_mesh_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BAKED_MESH_FILE_MAGIC, sizeof(BAKED_MESH_FILE_MAGIC));
+    header.version = BAKED_MESH_FILE_VERSION;
+    header.vertex_size = sizeof(struct standard_vertex_attribute);
+    header.triangle_count = mesh->triangle_count;
+    header.vertex_count = mesh->vertex_count;
+    header.meshlet_count = mesh->meshlet_count;
+    header.meshlet_vertex_count = mesh->meshlet_vertex_count;
+    for (int e = 0; e < 3; e++) {
+        header.center[e] = mesh->center.elements[e];
+    }
+    header.radius = mesh->radius;
+    header.texcoord_density = mesh->texcoord_density;
+    header.lod_error = mesh->lod_error;
+    header.level_count = level_count;
+    memcpy(header_bytes, &header, sizeof(header));
+    size_t index_count = (size_t)mesh->triangle_count * 3;
+    size_t padding = get_baked_mesh_level_size(&header) - CACHE_LINE_SIZE -
+                     get_baked_mesh_array_size(&header);
+    uint8_t padding_bytes[CACHE_LINE_SIZE] = {0};
+    return fwrite(header_bytes, CACHE_LINE_SIZE, 1, file) == 1 &&
+           fwrite(mesh->vertices, sizeof(struct standard_vertex_attribute),
+                  mesh->vertex_count, file) == mesh->vertex_count &&
+           fwrite(mesh->indices, sizeof(uint32_t), index_count, file) ==
+               index_count &&
+           fwrite(mesh->meshlets, sizeof(struct meshlet), mesh->meshlet_count,
+                  file) == mesh->meshlet_count &&
+           fwrite(mesh->meshlet_vertices, sizeof(uint32_t),
+                  mesh->meshlet_vertex_count,
+                  file) == mesh->meshlet_vertex_count &&
+           fwrite(padding_bytes, 1, padding, file) == padding;
+}
+
+// Writes the mesh and its levels of detail. The file is written next to its
+// final path first and then renamed, so that processes loading the mesh at
+// the same time never see a partial file.
+static bool save_baked_mesh(const struct baked_mesh *mesh, const char *path) {
+    size_t length = strlen(path);
+    char *temporary_path = malloc(length + 32);
+    if (temporary_path == NULL) {
+        return false;
+    }
+    snprintf(temporary_path, length + 32, "%s.%ld", path, (long)getpid());
+    FILE *file = fopen(temporary_path, "wb");
+    if (file == NULL) {
+        free(temporary_path);
+        return false;
+    }
+    uint32_t level_count = 0;
+    for (const struct baked_mesh *level = mesh; level != NULL;
+         level = level->coarser) {
+        level_count++;
+    }
+    bool result = true;
+    for (const struct baked_mesh *level = mesh; level != NULL && result;
+         level = level->coarser) {
+        result = write_baked_mesh_level(level, level == mesh ? level_count : 0,
+                                        file);
+    }
+    result = fclose(file) == 0 && result;
+    result = result && rename(temporary_path, path) == 0;
+    if (!result) {
+        remove(temporary_path);
+    }
+    free(temporary_path);
+    return result;
+}
+
+// Returns true if the header is of this build and its level fits in the
+// given size.
+static bool is_baked_mesh_header_valid(
+    const struct baked_mesh_file_header *header, size_t size) {
+    return memcmp(header->magic, BAKED_MESH_FILE_MAGIC,
+                  sizeof(BAKED_MESH_FILE_MAGIC)) == 0 &&
+           header->version == BAKED_MESH_FILE_VERSION &&
+           header->vertex_size == sizeof(struct standard_vertex_attribute) &&
+           get_baked_mesh_level_size(header) <= size;
+}
+
+static void set_baked_mesh_header(struct baked_mesh *mesh,
+                                  const struct baked_mesh_file_header *header) {
+    mesh->triangle_count = header->triangle_count;
+    mesh->vertex_count = header->vertex_count;
+    mesh->meshlet_count = header->meshlet_count;
+    mesh->meshlet_vertex_count = header->meshlet_vertex_count;
+    for (int e = 0; e < 3; e++) {
+        mesh->center.elements[e] = header->center[e];
+    }
+    mesh->radius = header->radius;
+    mesh->texcoord_density = header->texcoord_density;
+    mesh->lod_error = header->lod_error;
+}
+
+// Returns true if every index of the mesh refers to one of its vertices and
+// its meshlets split its triangles in order and refer to their own vertex
+// indices, so that a damaged file of the right size is never read out of
+// bounds.
+static bool are_baked_mesh_arrays_valid(const struct baked_mesh *mesh) {
+    size_t index_count = (size_t)mesh->triangle_count * 3;
+    for (size_t i = 0; i < index_count; i++) {
+        if (mesh->indices[i] >= mesh->vertex_count) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < mesh->meshlet_vertex_count; i++) {
+        if (mesh->meshlet_vertices[i] >= mesh->vertex_count) {
+            return false;
+        }
+    }
+    uint64_t next_triangle = 0;
+    for (uint32_t i = 0; i < mesh->meshlet_count; i++) {
+        const struct meshlet *meshlet = mesh->meshlets + i;
+        if (meshlet->first_triangle != next_triangle ||
+            meshlet->triangle_count > MESHLET_MAX_TRIANGLE_COUNT ||
+            meshlet->vertex_count > MESHLET_MAX_VERTEX_COUNT ||
+            (uint64_t)meshlet->first_vertex + meshlet->vertex_count >
+                mesh->meshlet_vertex_count) {
+            return false;
+        }
+        next_triangle += meshlet->triangle_count;
+    }
+    return next_triangle == mesh->triangle_count;
+}
+
+// Makes a mesh of the level of a baked mesh file at the offset of the
+// mapping, whose arrays point into the mapping, and moves the offset past it.
+// Returns NULL if the level does not fit or is invalid, or the memory cannot
+// be allocated.
+static struct baked_mesh *map_baked_mesh_level(uint8_t *mapping, size_t size,
+                                               size_t *offset) {
+    if (size - *offset < CACHE_LINE_SIZE) {
+        return NULL;
+    }
+    const struct baked_mesh_file_header *header =
+        (const struct baked_mesh_file_header *)(mapping + *offset);
+    if (!is_baked_mesh_header_valid(header, size - *offset)) {
+        return NULL;
+    }
+    struct baked_mesh *mesh = calloc(1, sizeof(struct baked_mesh));
+    if (mesh == NULL) {
+        return NULL;
+    }
+    set_baked_mesh_header(mesh, header);
+    // Mappings start on a page boundary and levels on a cache line, which
+    // keeps the vertices aligned to a cache line.
+    uint8_t *bytes = mapping + *offset;
+    mesh->vertices =
+        (struct standard_vertex_attribute *)(bytes + CACHE_LINE_SIZE);
+    mesh->indices = (uint32_t *)(mesh->vertices + mesh->vertex_count);
+    mesh->meshlets =
+        (struct meshlet *)(mesh->indices + 3 * (size_t)mesh->triangle_count);
+    mesh->meshlet_vertices = (uint32_t *)(mesh->meshlets + mesh->meshlet_count);
+    mesh->mapping = mapping;
+    *offset += get_baked_mesh_level_size(header);
+    if (!are_baked_mesh_arrays_valid(mesh)) {
+        free(mesh);
+        return NULL;
+    }
+    return mesh;
+}
+
+// Maps the baked mesh file if it is at least as new as the .obj file and its
+// contents are valid. The arrays of the returned mesh and of its levels of
+// detail point into the mapping.
+static struct baked_mesh *map_baked_mesh(const char *path,
+                                         const char *obj_path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat status, obj_status;
+    if (fstat(fd, &status) != 0 || (size_t)status.st_size < CACHE_LINE_SIZE ||
+        (stat(obj_path, &obj_status) == 0 &&
+         obj_status.st_mtime > status.st_mtime)) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)status.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    size_t offset = 0;
+    struct baked_mesh *mesh = map_baked_mesh_level(mapping, size, &offset);
+    if (mesh == NULL) {
+        munmap(mapping, size);
+        return NULL;
+    }
+    mesh->mapping_size = size;
+    uint32_t level_count =
+        ((const struct baked_mesh_file_header *)mapping)->level_count;
+    struct baked_mesh *last = mesh;
+    for (uint32_t i = 1; i < level_count && last != NULL; i++) {
+        last->coarser = map_baked_mesh_level(mapping, size, &offset);
+        last = last->coarser;
+    }
+    if (level_count == 0 || last == NULL || offset != size) {
+        destroy_baked_mesh(mesh);
+        return NULL;
+    }
+    return mesh;
+}
+
+struct baked_mesh *load_baked_mesh(const char *obj_path) {
+    char *path = get_baked_mesh_path(obj_path);
+    if (path == NULL) {
+        return NULL;
+    }
+    struct baked_mesh *baked = map_baked_mesh(path, obj_path);
+    if (baked == NULL) {
+        struct mesh *mesh = load_mesh(obj_path);
+        if (mesh == NULL) {
+            free(path);
+            return NULL;
+        }
+        baked = bake_mesh(mesh);
+        destroy_mesh(mesh);
+        // Without the levels of detail the mesh is drawn in full everywhere.
+        if (baked != NULL && !build_mesh_lods(baked)) {
+            printf("Cannot simplify %s.\n", obj_path);
+        }
+        // The cache only saves time on the next start, so failing to write it
+        // is not an error.
+        if (baked != NULL && !save_baked_mesh(baked, path)) {
+            printf("Cannot write %s.\n", path);
+        }
+    }
+    free(path);
+    return baked;
+}
+#else
+struct baked_mesh *load_baked_mesh(const char *obj_path) {
+    struct mesh *mesh = load_mesh(obj_path);
+    if (mesh == NULL) {
+        return NULL;
+    }
+    struct baked_mesh *baked = bake_mesh(mesh);
+    destroy_mesh(mesh);
+    if (baked != NULL && !build_mesh_lods(baked)) {
+        printf("Cannot simplify %s.\n", obj_path);
+    }
+    return baked;
+}
+#endif
+
+bool reserve_vertex_cache(struct vertex_cache *cache, uint32_t vertex_count) {
+    if (cache->capacity >= vertex_count) {
+        return true;
+    }
+    struct shaded_vertex *vertices = allocate_from_arena(
+        cache->arena, sizeof(struct shaded_vertex) * vertex_count);
+    uint8_t *used_vertices = allocate_from_arena(cache->arena, vertex_count);
+    if (vertices == NULL || used_vertices == NULL) {
+        return false;
+    }
+    cache->vertices = vertices;
+    cache->used_vertices = used_vertices;
+    cache->capacity = vertex_count;
+    return true;
+}
+
+void shade_vertex_range(vertex_shader shader, batch_vertex_shader batch_shader,
+                        const void *uniform, const struct baked_mesh *mesh,
+                        struct vertex_cache *cache, uint32_t first,
+                        uint32_t last) {
+    if (batch_shader != NULL) {
+        batch_shader(uniform, mesh, cache, first, last);
+        return;
+    }
+    for (uint32_t i = first; i < last; i++) {
+        if (mesh->used_vertices != NULL && !mesh->used_vertices[i]) {
+            continue;
+        }
+        struct shaded_vertex *shaded = cache->vertices + i;
+        memset(&shaded->context, 0, sizeof(struct shader_context));
+        shaded->position =
+            shader(&shaded->context, uniform, mesh->vertices + i);
+    }
+}
+
+// Hands the rasterizer a vertex that has already been shaded.
+static vector4 shaded_vertex_shader(struct shader_context *output,
+                                    const void *uniform, const void *vertex) {
+    (void)uniform;
+    const struct shaded_vertex *shaded = vertex;
+    *output = shaded->context;
+    return shaded->position;
+}
+
+// Hands the rasterizer only the biased position of a shaded vertex.
+static vector4 depth_prepass_vertex_shader(struct shader_context *output,
+                                           const void *uniform,
+                                           const void *vertex) {
+    (void)output;
+    (void)uniform;
+    vector4 position = ((const struct shaded_vertex *)vertex)->position;
+    position.z += DEPTH_PREPASS_BIAS * position.w;
+    return position;
+}
+
+vector4 depth_only_fragment_shader(struct shader_context *input,
+                                   const void *uniform) {
+    (void)input;
+    (void)uniform;
+    return (vector4){{0.0f, 0.0f, 0.0f, 0.0f}};
+}
+
+static void draw_cached_triangles(struct framebuffer *framebuffer,
+                                  const void *uniform,
+                                  const struct baked_mesh *mesh,
+                                  const struct vertex_cache *cache) {
+    const struct shaded_vertex *shaded = cache->vertices;
+    const uint32_t *indices = mesh->indices;
+    for (uint32_t t = 0; t < mesh->triangle_count; t++, indices += 3) {
+        const void *vertex_ptrs[3] = {shaded + indices[0], shaded + indices[1],
+                                      shaded + indices[2]};
+        draw_triangle(framebuffer, uniform, vertex_ptrs);
+    }
+}
+
+void draw_shaded(struct framebuffer *framebuffer, fragment_shader shader,
+                 const void *uniform, const struct baked_mesh *mesh,
+                 const struct vertex_cache *cache) {
+    set_vertex_shader(shaded_vertex_shader);
+    set_fragment_shader(shader);
+    draw_cached_triangles(framebuffer, uniform, mesh, cache);
+}
+
+void draw_shaded_depth(struct framebuffer *framebuffer,
+                       const struct baked_mesh *mesh,
+                       const struct vertex_cache *cache) {
+    set_vertex_shader(depth_prepass_vertex_shader);
+    set_fragment_shader(depth_only_fragment_shader);
+    draw_cached_triangles(framebuffer, NULL, mesh, cache);
+}
+
+// The planes of the view frustum in local space, extracted from the rows of
+// local2clip and normalized. Points inside have positive distances.
+struct frustum {
+    float planes[6][4];
+};
+
+static void get_frustum(matrix4x4 local2clip, struct frustum *frustum) {
+    const float(*m)[4] = local2clip.elements;
+    for (int row = 0; row < 3; row++) {
+        for (int sign = -1; sign <= 1; sign += 2) {
+            float *plane = frustum->planes[2 * row + (sign + 1) / 2];
+            for (int c = 0; c < 4; c++) {
+                plane[c] = m[3][c] + (float)sign * m[row][c];
+            }
+            float length = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] +
+                                 plane[2] * plane[2]);
+            for (int c = 0; length > 0.0f && c < 4; c++) {
+                plane[c] /= length;
+            }
+        }
+    }
+}
+
+// Returns true if the sphere is entirely outside one of the planes.
+static bool is_sphere_outside_frustum(const struct frustum *frustum,
+                                      vector3 center, float radius) {
+    for (int i = 0; i < 6; i++) {
+        const float *plane = frustum->planes[i];
+        float distance = plane[0] * center.x + plane[1] * center.y +
+                         plane[2] * center.z + plane[3];
+        if (distance < -radius) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Where the camera of a draw sees the mesh from, in local space.
+struct viewpoint {
+    bool orthographic;
+    // The camera position, or for orthographic projections the unit direction
+    // the camera looks in.
+    vector3 position;
+    // 1 if front faces have normals towards the camera, or -1 if local2clip
+    // mirrors the mesh.
+    float facing;
+};
+
+static float get_determinant3(vector3 a, vector3 b, vector3 c) {
+    return vector3_dot(a, vector3_cross(b, c));
+}
+
+// The camera is the point that clip space x, y and w are all zero at, or the
+// direction they are, which is found as the cross product of these rows of
+// local2clip. Returns false if local2clip is singular.
+static bool get_viewpoint(matrix4x4 local2clip, struct viewpoint *viewpoint) {
+    const float(*m)[4] = local2clip.elements;
+    const int rows[3] = {0, 1, 3};
+    float camera[4];
+    for (int j = 0; j < 4; j++) {
+        vector3 minor[3];
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0, e = 0; c < 4; c++) {
+                if (c != j) {
+                    minor[r].elements[e++] = m[rows[r]][c];
+                }
+            }
+        }
+        // Cofactors of row 2, so that the dot product of a row of local2clip
+        // and the camera is the determinant with that row in place of row 2.
+        float sign = j % 2 == 0 ? 1.0f : -1.0f;
+        camera[j] = sign * get_determinant3(minor[0], minor[1], minor[2]);
+    }
+    float determinant = 0.0f;
+    for (int j = 0; j < 4; j++) {
+        determinant += m[2][j] * camera[j];
+    }
+    vector3 direction = {{camera[0], camera[1], camera[2]}};
+    float length = vector3_length(direction);
+    if (determinant == 0.0f || length == 0.0f) {
+        return false;
+    }
+    // Projections that keep front faces counter-clockwise on the screen have
+    // a negative determinant.
+    viewpoint->facing = determinant < 0.0f ? 1.0f : -1.0f;
+    viewpoint->orthographic = fabsf(camera[3]) <= 1e-6f * length;
+    if (viewpoint->orthographic) {
+        // Depth increases along the view direction, and front faces have
+        // normals against it whatever the facing.
+        viewpoint->position = vector3_multiply_scalar(
+            direction, (determinant < 0.0f ? -1.0f : 1.0f) / length);
+        viewpoint->facing = 1.0f;
+    } else {
+        viewpoint->position =
+            vector3_multiply_scalar(direction, 1.0f / camera[3]);
+    }
+    return true;
+}
+
+// Margin on the sine of the cone angle, so that meshlets with triangles that
+// are nearly edge-on are left to the triangle tests.
+#define CONE_CUTOFF_EPSILON 1e-3f
+
+// Returns true if all triangles of the meshlet face away from the camera.
+static bool is_meshlet_back_facing(const struct viewpoint *viewpoint,
+                                   const struct meshlet *meshlet) {
+    vector3 axis =
+        vector3_multiply_scalar(meshlet->cone_axis, viewpoint->facing);
+    float cutoff = meshlet->cone_cutoff + CONE_CUTOFF_EPSILON;
+    if (viewpoint->orthographic) {
+        return vector3_dot(viewpoint->position, axis) >= cutoff;
+    }
+    // Every direction from the camera into the bounding sphere is within the
+    // complement of the cone angle from the axis.
+    vector3 offset = vector3_subtract(meshlet->center, viewpoint->position);
+    return vector3_dot(offset, axis) >=
+           cutoff * vector3_length(offset) + meshlet->radius;
+}
+
+// What the triangle tests need of a vertex, found once for every meshlet that
+// uses it rather than once for every triangle.
+struct projected_vertex {
+    // Normalized device coordinates, unless the vertex is behind the camera.
+    float x, y;
+    // The outcode from project_position_batch().
+    int code;
+};
+
+// Transforms the positions of the vertices at the indices by the matrix and
+// projects them into the entries of projected at the same indices, a batch
+// at a time.
+static void project_positions(
+    matrix4x4 matrix, const struct standard_vertex_attribute *vertices,
+    const uint32_t *indices, uint32_t count,
+    struct projected_vertex *projected) {
+    struct position_batch batch;
+    int32_t codes[POSITION_BATCH_SIZE];
+    float x[POSITION_BATCH_SIZE], y[POSITION_BATCH_SIZE];
+    for (uint32_t first = 0; first < count; first += POSITION_BATCH_SIZE) {
+        uint32_t batch_count = count - first < POSITION_BATCH_SIZE
+                                   ? count - first
+                                   : POSITION_BATCH_SIZE;
+        transform_position_batch(matrix, vertices, indices + first,
+                                 batch_count, &batch);
+        project_position_batch(&batch, batch_count, codes, x, y);
+        for (uint32_t i = 0; i < batch_count; i++) {
+            struct projected_vertex *vertex = projected + indices[first + i];
+            vertex->x = x[i];
+            vertex->y = y[i];
+            vertex->code = codes[i];
+        }
+    }
+}
+
+// Normalized device space area below which a triangle counts as back-facing.
+// The positions here are not rounded exactly like the vertex shader's, so
+// triangles that are nearly edge-on are left to the rasterizer.
+#define BACK_FACE_AREA_EPSILON 1e-7f
+
+static bool is_back_facing(const struct projected_vertex *a,
+                           const struct projected_vertex *b,
+                           const struct projected_vertex *c) {
+    // Triangles crossing the camera plane are clipped by the rasterizer.
+    if (((a->code | b->code | c->code) & OUTCODE_BEHIND_CAMERA) != 0) {
+        return false;
+    }
+    float area = (b->x - a->x) * (c->y - a->y) - (c->x - a->x) * (b->y - a->y);
+    return area < -BACK_FACE_AREA_EPSILON;
+}
+
+// Adds the triangles of the meshlet that the culling keeps to the view.
+static void cull_meshlet(const struct baked_mesh *mesh,
+                         const struct meshlet *meshlet,
+                         const struct draw_culling *culling,
+                         struct projected_vertex *projected,
+                         struct vertex_cache *cache, struct baked_mesh *view) {
+    project_positions(culling->local2clip, mesh->vertices,
+                      mesh->meshlet_vertices + meshlet->first_vertex,
+                      meshlet->vertex_count, projected);
+    const uint32_t *indices = mesh->indices + 3 * meshlet->first_triangle;
+    uint32_t *kept = cache->indices + 3 * (size_t)view->triangle_count;
+    for (uint32_t t = 0; t < meshlet->triangle_count; t++, indices += 3) {
+        const struct projected_vertex *a = projected + indices[0];
+        const struct projected_vertex *b = projected + indices[1];
+        const struct projected_vertex *c = projected + indices[2];
+        if ((a->code & b->code & c->code & (OUTCODE_BEHIND_CAMERA - 1)) != 0) {
+            continue;
+        }
+        if (culling->back_faces && is_back_facing(a, b, c)) {
+            continue;
+        }
+        for (int v = 0; v < 3; v++) {
+            kept[v] = indices[v];
+            if (!cache->used_vertices[indices[v]]) {
+                cache->used_vertices[indices[v]] = 1;
+                cache->used_vertex_count++;
+            }
+        }
+        kept += 3;
+        view->triangle_count++;
+    }
+}
+
+bool cull_mesh(const struct baked_mesh *mesh,
+               const struct draw_culling *culling, struct vertex_cache *cache,
+               struct baked_mesh *view) {
+    size_t index_count = (size_t)mesh->triangle_count * 3;
+    if (!reserve_vertex_cache(cache, mesh->vertex_count)) {
+        return false;
+    }
+    if (cache->index_capacity < index_count) {
+        uint32_t *indices =
+            allocate_from_arena(cache->arena, sizeof(uint32_t) * index_count);
+        if (indices == NULL) {
+            return false;
+        }
+        cache->indices = indices;
+        cache->index_capacity = (uint32_t)index_count;
+    }
+    *view = *mesh;
+    view->mapping = NULL;
+    view->mapping_size = 0;
+    view->indices = cache->indices;
+    view->used_vertices = cache->used_vertices;
+    view->triangle_count = 0;
+    view->meshlet_count = 0;
+    view->meshlet_vertex_count = 0;
+    view->meshlets = NULL;
+    view->meshlet_vertices = NULL;
+    memset(cache->used_vertices, 0, mesh->vertex_count);
+    cache->used_vertex_count = 0;
+    cache->culled_meshlet_count = 0;
+    struct frustum frustum;
+    get_frustum(culling->local2clip, &frustum);
+    if (is_sphere_outside_frustum(&frustum, mesh->center, mesh->radius)) {
+        cache->culled_meshlet_count = mesh->meshlet_count;
+        return true;
+    }
+    struct projected_vertex *projected = allocate_from_arena(
+        cache->arena, sizeof(struct projected_vertex) * mesh->vertex_count);
+    if (projected == NULL) {
+        return false;
+    }
+    struct viewpoint viewpoint;
+    bool cones = culling->back_faces &&
+                 get_viewpoint(culling->local2clip, &viewpoint);
+    for (uint32_t i = 0; i < mesh->meshlet_count; i++) {
+        const struct meshlet *meshlet = mesh->meshlets + i;
+        if (is_sphere_outside_frustum(&frustum, meshlet->center,
+                                      meshlet->radius) ||
+            (cones && is_meshlet_back_facing(&viewpoint, meshlet))) {
+            cache->culled_meshlet_count++;
+            continue;
+        }
+        cull_meshlet(mesh, meshlet, culling, projected, cache, view);
+    }
+    return true;
+}
+
+bool draw_indexed(struct framebuffer *framebuffer,
+                  vertex_shader vertex_shader,
+                  fragment_shader fragment_shader, const void *uniform,
+                  const struct baked_mesh *mesh, struct vertex_cache *cache) {
+    if (!reserve_vertex_cache(cache, mesh->vertex_count)) {
+        return false;
+    }
+    shade_vertex_range(vertex_shader, NULL, uniform, mesh, cache, 0,
+                       mesh->vertex_count);
+    draw_shaded(framebuffer, fragment_shader, uniform, mesh, cache);
+    return true;
+}
@@ -0,0 +1,211 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#ifndef BAKED_MESH_H_
+#define BAKED_MESH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "graphics/framebuffer.h"
+#include "graphics/rasterizer.h"
+#include "math/matrix.h"
+#include "math/vector.h"
+#include "shaders/standard.h"
+#include "utilities/mesh.h"
+
+#include "frame_arena.h"
+
+// Largest meshlet. The sizes of GPU meshlets also keep the meshlets of large
+// meshes small enough to be culled as a whole often.
+#define MESHLET_MAX_VERTEX_COUNT 64
+#define MESHLET_MAX_TRIANGLE_COUNT 124
+
+// A run of consecutive triangles of a baked mesh, with bounds that cull all of
+// them at once before any of them is looked at.
+struct meshlet {
+    // A sphere that contains the vertices of the meshlet, in local space.
+    vector3 center;
+    float radius;
+    // The front face normals of all triangles are within the cone around the
+    // axis whose half angle has cone_cutoff as its sine. The cutoff is above
+    // 1 if the normals are spread too widely for the cone to cull anything.
+    vector3 cone_axis;
+    float cone_cutoff;
+    uint32_t first_triangle, triangle_count;
+    // The unique vertex indices of the triangles in the meshlet_vertices of
+    // the mesh.
+    uint32_t first_vertex, vertex_count;
+};
+
+// A mesh whose vertex attributes have been fetched once up front, so drawing
+// it does not go through the get_mesh_* accessors every frame. Corners that
+// share all of their attributes are stored once and referenced by index.
+struct baked_mesh {
+    // A sphere that contains all vertices, in local space.
+    vector3 center;
+    float radius;
+    // Texcoord units per unit of length on the surface, the square root of
+    // the texcoord area over the surface area of all triangles.
+    float texcoord_density;
+    uint32_t triangle_count;
+    uint32_t vertex_count;
+    // Unique vertices. The array starts on a cache line boundary.
+    struct standard_vertex_attribute *vertices;
+    // Three consecutive vertex indices per triangle.
+    uint32_t *indices;
+    // All triangles split into meshlets in order, and the vertex indices the
+    // meshlets refer to. Views made by cull_mesh() have no meshlets.
+    uint32_t meshlet_count;
+    uint32_t meshlet_vertex_count;
+    struct meshlet *meshlets;
+    uint32_t *meshlet_vertices;
+    // The baked mesh file all arrays point into, or NULL if they are
+    // allocated. The levels of detail of a mapped mesh point into its mapping
+    // and have a size of zero.
+    void *mapping;
+    size_t mapping_size;
+    // A flag per vertex that is set if any triangle uses the vertex, or NULL
+    // if all vertices are used. Only views made by cull_mesh() have it.
+    const uint8_t *used_vertices;
+    // A simplified version of the mesh with fewer triangles, which has a
+    // coarser one in turn, or NULL. Only meshes from load_baked_mesh() have
+    // them, and they are destroyed with the mesh.
+    struct baked_mesh *coarser;
+    // How far the simplification moved any vertex, in local space. Zero for
+    // the mesh itself.
+    float lod_error;
+};
+
+// The output of a vertex shader for one vertex.
+struct shaded_vertex {
+    vector4 position;
+    struct shader_context context;
+};
+
+// Storage for the shaded vertices of one draw, allocated from a frame arena.
+// The storage is never freed on its own, so a cache should start empty for
+// every draw and the arena be released after it.
+struct vertex_cache {
+    struct frame_arena *arena;
+    uint32_t capacity;
+    struct shaded_vertex *vertices;
+    // The triangles and vertex flags of the last view made by cull_mesh().
+    uint32_t index_capacity;
+    uint32_t *indices;
+    uint8_t *used_vertices;
+    uint32_t used_vertex_count;
+    // The meshlets the last view culled without testing their triangles.
+    uint32_t culled_meshlet_count;
+};
+
+// Culling of one draw, decided from the positions of the mesh alone before any
+// vertex is shaded.
+struct draw_culling {
+    // The transform the vertex shader applies to positions.
+    matrix4x4 local2clip;
+    // Also culls the triangles facing away from the camera, which the
+    // rasterizer would discard. Triangles are front-facing if they are
+    // counter-clockwise on the screen.
+    bool back_faces;
+};
+
+// Copies the attributes of all triangles of the mesh, removes duplicated
+// vertices and splits the triangles into meshlets. The mesh is no longer
+// needed once this returns. Returns NULL if the memory cannot be allocated.
+struct baked_mesh *bake_mesh(const struct mesh *mesh);
+
+// Loads the baked mesh of an .obj file from the binary file next to it, with
+// ".baked" appended to the name. The file is memory-mapped and used in place.
+// If it is missing, invalid or older than the .obj file, the .obj file is
+// loaded and baked instead, its coarser levels of detail are built, and the
+// file is written with all levels for the next start.
+// Returns NULL if the mesh cannot be loaded.
+struct baked_mesh *load_baked_mesh(const char *obj_path);
+
+void destroy_baked_mesh(struct baked_mesh *mesh);
+
+// Returns the coarsest level of detail of the mesh whose simplification
+// moves no vertex by more than about max_error pixels, when the mesh is drawn
+// through local2clip to a viewport of the given size, or the mesh itself.
+// Levels are only taken while the bounding sphere is entirely in front of the
+// camera.
+const struct baked_mesh *select_mesh_lod(const struct baked_mesh *mesh,
+                                         matrix4x4 local2clip, uint32_t width,
+                                         uint32_t height, float max_error);
+
+// Shades the unique vertices [first, last) of the mesh that it uses into the
+// cache, like calling a vertex shader on each of them, but a batch at a time,
+// so that the positions of a batch are transformed together.
+typedef void (*batch_vertex_shader)(const void *uniform,
+                                    const struct baked_mesh *mesh,
+                                    struct vertex_cache *cache, uint32_t first,
+                                    uint32_t last);
+
+// Makes room for at least vertex_count shaded vertices in the cache. Returns
+// false if the memory cannot be allocated from its arena.
+bool reserve_vertex_cache(struct vertex_cache *cache, uint32_t vertex_count);
+
+// Runs the vertex shader for the unique vertices [first, last) of the mesh that
+// it uses and stores the results in the cache, which must have room for them.
+// The vertex shader must accept struct standard_vertex_attribute vertices.
+// batch_shader is used instead if it is not NULL.
+void shade_vertex_range(vertex_shader shader, batch_vertex_shader batch_shader,
+                        const void *uniform, const struct baked_mesh *mesh,
+                        struct vertex_cache *cache, uint32_t first,
+                        uint32_t last);
+
+// Draws all triangles of the mesh from the vertices shaded into the cache with
+// the fragment shader. This changes the bound shaders.
+void draw_shaded(struct framebuffer *framebuffer, fragment_shader shader,
+                 const void *uniform, const struct baked_mesh *mesh,
+                 const struct vertex_cache *cache);
+
+// Clip-space z offset, relative to w, that a depth pre-pass is pushed back by.
+// The depth test of the rasterizer rejects equal depths, so without it the
+// shading pass would fail everywhere the pre-pass drew. Fragments farther
+// behind the visible surface than this are rejected by the shading pass.
+#define DEPTH_PREPASS_BIAS 1e-5f
+
+// Depth pre-pass: draws only the depth of all triangles shaded into the cache,
+// pushed back by DEPTH_PREPASS_BIAS. A following draw_shaded() of the same
+// vertices then only passes the depth test at visible fragments, so the
+// fragment shader runs about once per covered pixel. This relies on the
+// rasterizer testing depth before it calls the fragment shader. This changes
+// the bound shaders.
+void draw_shaded_depth(struct framebuffer *framebuffer,
+                       const struct baked_mesh *mesh,
+                       const struct vertex_cache *cache);
+
+// A fragment shader for passes that only write depth.
+vector4 depth_only_fragment_shader(struct shader_context *input,
+                                   const void *uniform);
+
+// Makes a view of the mesh without the triangles the culling removes: the
+// whole mesh or the meshlets whose bounding spheres are outside the view
+// frustum, the meshlets whose normal cones face away from the camera if back
+// faces are culled, then every remaining triangle with all vertices outside
+// the same frustum plane, and the back faces if requested. Only the vertices
+// of the remaining meshlets are transformed, and only the vertices of the
+// remaining triangles are shaded when the view is drawn. The view shares the
+// vertices of the mesh and keeps its triangles in the cache, so it is valid
+// until the cache is used for another view or its arena is released, and must
+// not be destroyed.
+// Returns false if the cache cannot grow to the size of the mesh.
+bool cull_mesh(const struct baked_mesh *mesh,
+               const struct draw_culling *culling, struct vertex_cache *cache,
+               struct baked_mesh *view);
+
+// Runs the vertex shader once for every unique vertex of the mesh, then draws
+// all triangles from the shaded vertices with the fragment shader. This
+// changes the bound shaders. Returns false if the vertex cache cannot grow to
+// the size of the mesh, in which case nothing is drawn.
+bool draw_indexed(struct framebuffer *framebuffer,
+                  vertex_shader vertex_shader,
+                  fragment_shader fragment_shader, const void *uniform,
+                  const struct baked_mesh *mesh, struct vertex_cache *cache);
+
+#endif  // BAKED_MESH_H_
@@ -0,0 +1,518 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "bench.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "graphics/texture.h"
+#include "utilities/image.h"
+
+#include "profiler.h"
+#include "render_target.h"
+#include "scene.h"
+#include "scene_renderer.h"
+#include "tile_renderer.h"
+
+// Frames spread evenly over each clip, so that the camera and the model are
+// seen from the angles the whole clip shows.
+#define BENCH_FRAME_COUNT 4
+#define MAX_THREAD_COUNTS 16
+
+#define DEFAULT_CHECK_DIRECTORY "golden"
+#define CHECK_BASELINE_NAME "baseline.txt"
+#define CHECK_PATH_SIZE 512
+// Clips, sizes and thread counts the baseline file keeps times for.
+#define MAX_BASELINE_COUNT 64
+
+static int get_bench_variable(const char *name, int default_value) {
+    const char *value = getenv(name);
+    if (value == NULL || value[0] == '\0') {
+        return default_value;
+    }
+    int number = atoi(value);
+    return number >= 0 ? number : default_value;
+}
+
+// Parses ANIM_BENCH_THREADS into thread_counts. Returns the number of thread
+// counts.
+static int get_bench_thread_counts(int *thread_counts) {
+    const char *value = getenv("ANIM_BENCH_THREADS");
+    int count = 0;
+    while (value != NULL && *value != '\0' && count < MAX_THREAD_COUNTS) {
+        char *end;
+        long thread_count = strtol(value, &end, 10);
+        if (end == value) {
+            break;
+        }
+        if (thread_count > 0 && thread_count <= 1024) {
+            thread_counts[count++] = (int)thread_count;
+        }
+        value = *end == ',' ? end + 1 : end;
+    }
+    if (count == 0) {
+        thread_counts[count++] = get_tile_thread_count();
+    }
+    return count;
+}
+
+static void get_bench_frames(const struct scene *scene, int *frames) {
+    int frame_count = get_scene_frame_count(scene);
+    for (int i = 0; i < BENCH_FRAME_COUNT; i++) {
+        frames[i] = i * frame_count / BENCH_FRAME_COUNT;
+    }
+}
+
+static double get_time(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void render_bench_frames(struct render_target *target,
+                                const struct scene_context *context,
+                                const int *frames) {
+    for (int i = 0; i < BENCH_FRAME_COUNT; i++) {
+        render_scene_frame(target, context, frames[i]);
+    }
+}
+
+static bool run_scene_benchmark(const struct scene_context *context,
+                                int thread_count, int warmup_count,
+                                double *repetition_times,
+                                int repetition_count) {
+    const struct scene *scene = context->scene;
+    struct render_target_settings settings = {
+        scene->image_width,      scene->image_height,
+        scene->shadow_map_width, scene->shadow_map_height,
+        thread_count,            get_depth_prepass(),
+        get_max_lod_error(),     1,
+        NULL};
+    struct render_target *target = create_render_target(&settings);
+    if (target == NULL) {
+        printf("Cannot create render target.\n");
+        return false;
+    }
+    int frames[BENCH_FRAME_COUNT];
+    get_bench_frames(scene, frames);
+
+    // Count the work of the frames in an untimed pass, since counting
+    // fragments slows down shading.
+    set_profiling(true);
+    render_bench_frames(target, context, frames);
+    uint64_t triangles = take_profile_count(PROFILE_COUNTER_TRIANGLES);
+    uint64_t fragments = take_profile_count(PROFILE_COUNTER_SHADED_FRAGMENTS);
+    set_profiling(false);
+
+    for (int i = 0; i < warmup_count; i++) {
+        render_bench_frames(target, context, frames);
+    }
+    for (int i = 0; i < repetition_count; i++) {
+        double start = get_time();
+        render_bench_frames(target, context, frames);
+        repetition_times[i] = (get_time() - start) / BENCH_FRAME_COUNT;
+    }
+    destroy_render_target(target);
+
+    qsort(repetition_times, (size_t)repetition_count, sizeof(double),
+          compare_doubles);
+    double median = repetition_times[repetition_count / 2];
+    printf("%-12s %5ux%-5u %7d %9.2f %9.2f %12.2f %12.2f\n",
+           scene->output_directory, scene->image_width, scene->image_height,
+           thread_count, repetition_times[0] * 1000.0, median * 1000.0,
+           (double)triangles / BENCH_FRAME_COUNT / median * 1e-6,
+           (double)fragments / BENCH_FRAME_COUNT / median * 1e-6);
+    fflush(stdout);
+    return true;
+}
+
+bool run_benchmark(const struct scene_context *contexts, int count) {
+    int warmup_count = get_bench_variable("ANIM_BENCH_WARMUP", 1);
+    int repetition_count = get_bench_variable("ANIM_BENCH_REPEAT", 5);
+    if (repetition_count < 1) {
+        repetition_count = 1;
+    }
+    int thread_counts[MAX_THREAD_COUNTS];
+    int thread_count_count = get_bench_thread_counts(thread_counts);
+    double *repetition_times =
+        malloc(sizeof(double) * (size_t)repetition_count);
+    if (repetition_times == NULL) {
+        printf("Cannot allocate memory for the benchmark.\n");
+        return false;
+    }
+    printf("%d frames per repetition, %d warmup and %d timed repetitions, "
+           "depth pre-pass %s, level of detail error %g pixels.\n",
+           BENCH_FRAME_COUNT, warmup_count, repetition_count,
+           get_depth_prepass() ? "on" : "off", get_max_lod_error());
+    printf("%-12s %11s %7s %9s %9s %12s %12s\n", "clip", "size", "threads",
+           "min ms", "median ms", "Mtriangles/s", "Mfragments/s");
+    bool succeeded = true;
+    for (int i = 0; i < count && succeeded; i++) {
+        for (int t = 0; t < thread_count_count && succeeded; t++) {
+            succeeded = run_scene_benchmark(contexts + i, thread_counts[t],
+                                            warmup_count, repetition_times,
+                                            repetition_count);
+        }
+    }
+    free(repetition_times);
+    return succeeded;
+}
+
+static float get_check_variable(const char *name, float default_value) {
+    const char *value = getenv(name);
+    if (value == NULL || value[0] == '\0') {
+        return default_value;
+    }
+    return (float)atof(value);
+}
+
+// What --check allows a frame and a clip to differ from the stored ones by.
+struct check_budget {
+    // Channel differences up to this mark a pixel as the same.
+    int tolerance;
+    float min_psnr;
+    // The fraction of pixels that may differ by more than the tolerance.
+    float max_different_pixels;
+    // How much slower than the baseline a clip may be, in percent.
+    float max_slowdown;
+};
+
+// The median time per frame of a clip the last time it was recorded.
+struct baseline_time {
+    char clip[SCENE_STRING_SIZE];
+    uint32_t width, height;
+    int thread_count;
+    double frame_ms;
+};
+
+struct baseline {
+    int count;
+    struct baseline_time times[MAX_BASELINE_COUNT];
+};
+
+struct image_difference {
+    // Over the color channels. Infinite if the images are the same.
+    double psnr;
+    int max_difference;
+    uint64_t different_pixels;
+};
+
+// Reads the baseline file of the directory if it exists, one line per clip
+// with its name, size, thread count and time per frame.
+static void load_baseline(const char *directory, struct baseline *baseline) {
+    char path[CHECK_PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/%s", directory, CHECK_BASELINE_NAME);
+    baseline->count = 0;
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return;
+    }
+    struct baseline_time *time = baseline->times;
+    while (baseline->count < MAX_BASELINE_COUNT &&
+           fscanf(file, "%127s %ux%u %d %lf", time->clip, &time->width,
+                  &time->height, &time->thread_count,
+                  &time->frame_ms) == 5) {
+        baseline->count++;
+        time++;
+    }
+    fclose(file);
+}
+
+static bool save_baseline(const char *directory,
+                          const struct baseline *baseline) {
+    char path[CHECK_PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/%s", directory, CHECK_BASELINE_NAME);
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+    for (int i = 0; i < baseline->count; i++) {
+        const struct baseline_time *time = baseline->times + i;
+        fprintf(file, "%s %ux%u %d %.3f\n", time->clip, time->width,
+                time->height, time->thread_count, time->frame_ms);
+    }
+    return fclose(file) == 0;
+}
+
+// Returns the baseline time of the clip, or NULL if it has none.
+static struct baseline_time *find_baseline_time(struct baseline *baseline,
+                                                const struct scene *scene,
+                                                int thread_count) {
+    for (int i = 0; i < baseline->count; i++) {
+        struct baseline_time *time = baseline->times + i;
+        if (strcmp(time->clip, scene->output_directory) == 0 &&
+            time->width == scene->image_width &&
+            time->height == scene->image_height &&
+            time->thread_count == thread_count) {
+            return time;
+        }
+    }
+    return NULL;
+}
+
+// Returns the path of the golden image of a frame in the directory, which
+// mirrors where the frame is saved when the clip is rendered. Returns false
+// if the path does not fit.
+static bool get_golden_path(const char *directory, const struct scene *scene,
+                            int frame, char path[CHECK_PATH_SIZE]) {
+    int length = snprintf(path, CHECK_PATH_SIZE, "%s/%s/", directory,
+                          scene->output_directory);
+    if (length < 0 || length >= CHECK_PATH_SIZE) {
+        return false;
+    }
+    int name_length = snprintf(path + length, CHECK_PATH_SIZE - length,
+                               scene->output_name_format, frame);
+    return name_length >= 0 && name_length < CHECK_PATH_SIZE - length;
+}
+
+// Compares two RGBA images of the same size.
+static void compare_images(const struct texture *image,
+                           const struct texture *golden, int tolerance,
+                           struct image_difference *difference) {
+    const uint8_t *pixels = image->pixels;
+    const uint8_t *golden_pixels = golden->pixels;
+    size_t pixel_count = (size_t)image->width * image->height;
+    double squared_error = 0.0;
+    difference->max_difference = 0;
+    difference->different_pixels = 0;
+    for (size_t i = 0; i < pixel_count; i++) {
+        int pixel_difference = 0;
+        for (int c = 0; c < 3; c++) {
+            int channel_difference =
+                abs((int)pixels[i * 4 + c] - (int)golden_pixels[i * 4 + c]);
+            squared_error += (double)channel_difference * channel_difference;
+            if (channel_difference > pixel_difference) {
+                pixel_difference = channel_difference;
+            }
+        }
+        if (pixel_difference > difference->max_difference) {
+            difference->max_difference = pixel_difference;
+        }
+        difference->different_pixels += pixel_difference > tolerance;
+    }
+    double mean_squared_error = squared_error / (3.0 * (double)pixel_count);
+    difference->psnr = mean_squared_error > 0.0
+                           ? 10.0 * log10(255.0 * 255.0 / mean_squared_error)
+                           : INFINITY;
+}
+
+// Saves the frame in the target as its golden image, or compares it with the
+// golden image. Returns false if the image cannot be saved or loaded, or the
+// frame is not within the budget.
+static bool check_frame(const struct render_target *target,
+                        const struct scene *scene, int frame,
+                        const char *directory, bool record,
+                        const struct check_budget *budget) {
+    char path[CHECK_PATH_SIZE];
+    if (!get_golden_path(directory, scene, frame, path)) {
+        printf("Cannot name the golden image of frame %d.\n", frame);
+        return false;
+    }
+    if (record) {
+        // Images are saved top row first, like the frames of a clip.
+        if (!save_image(target->color_buffer, path, true)) {
+            printf("Cannot write %s.\n", path);
+            return false;
+        }
+        printf("%-12s %5d %9s\n", scene->output_directory, frame, "recorded");
+        return true;
+    }
+    struct texture *golden = load_image(path, true);
+    if (golden == NULL || golden->width != target->width ||
+        golden->height != target->height ||
+        (golden->format != TEXTURE_FORMAT_SRGB8_A8 &&
+         golden->format != TEXTURE_FORMAT_RGBA8)) {
+        printf("Cannot load %s as a %ux%u RGBA image.\n", path, target->width,
+               target->height);
+        if (golden != NULL) {
+            destroy_texture(golden);
+        }
+        return false;
+    }
+    struct image_difference difference;
+    compare_images(target->color_buffer, golden, budget->tolerance,
+                   &difference);
+    destroy_texture(golden);
+    double different_fraction = (double)difference.different_pixels /
+                                ((double)target->width * target->height);
+    bool passed = difference.psnr >= budget->min_psnr &&
+                  different_fraction <= budget->max_different_pixels;
+    printf("%-12s %5d %9.2f %8d %10llu %s\n", scene->output_directory, frame,
+           difference.psnr, difference.max_difference,
+           (unsigned long long)difference.different_pixels,
+           passed ? "ok" : "FAILED");
+    return passed;
+}
+
+// Checks the benchmark frames of the clip against their golden images, then
+// times them like the benchmark and checks the median time per frame against
+// the baseline, or records the images and the time. Returns false if the
+// clip cannot be checked or is not within the budget.
+static bool check_scene(const struct scene_context *context,
+                        const char *directory, bool record,
+                        const struct check_budget *budget,
+                        int repetition_count, double *repetition_times,
+                        struct baseline *baseline) {
+    const struct scene *scene = context->scene;
+    int thread_count = get_tile_thread_count();
+    struct render_target_settings settings = {
+        scene->image_width,      scene->image_height,
+        scene->shadow_map_width, scene->shadow_map_height,
+        thread_count,            get_depth_prepass(),
+        get_max_lod_error(),     1,
+        NULL};
+    struct render_target *target = create_render_target(&settings);
+    if (target == NULL) {
+        printf("Cannot create render target.\n");
+        return false;
+    }
+    if (record) {
+        char path[CHECK_PATH_SIZE];
+        snprintf(path, sizeof(path), "%s/%s", directory,
+                 scene->output_directory);
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            printf("Cannot create %s.\n", path);
+            destroy_render_target(target);
+            return false;
+        }
+    }
+    int frames[BENCH_FRAME_COUNT];
+    get_bench_frames(scene, frames);
+    // Rendering the frames to check them also warms up the timed passes.
+    bool passed = true;
+    for (int i = 0; i < BENCH_FRAME_COUNT; i++) {
+        render_scene_frame(target, context, frames[i]);
+        passed = check_frame(target, scene, frames[i], directory, record,
+                             budget) &&
+                 passed;
+    }
+    for (int i = 0; i < repetition_count; i++) {
+        double start = get_time();
+        render_bench_frames(target, context, frames);
+        repetition_times[i] = (get_time() - start) / BENCH_FRAME_COUNT;
+    }
+    destroy_render_target(target);
+
+    qsort(repetition_times, (size_t)repetition_count, sizeof(double),
+          compare_doubles);
+    double frame_ms = repetition_times[repetition_count / 2] * 1000.0;
+    struct baseline_time *time =
+        find_baseline_time(baseline, scene, thread_count);
+    if (record) {
+        if (time == NULL && baseline->count < MAX_BASELINE_COUNT) {
+            time = baseline->times + baseline->count++;
+            snprintf(time->clip, sizeof(time->clip), "%s",
+                     scene->output_directory);
+            time->width = scene->image_width;
+            time->height = scene->image_height;
+            time->thread_count = thread_count;
+        }
+        if (time != NULL) {
+            time->frame_ms = frame_ms;
+        }
+        printf("%-12s %ux%u, %d threads: %.2f ms per frame, recorded\n",
+               scene->output_directory, scene->image_width,
+               scene->image_height, thread_count, frame_ms);
+        return passed;
+    }
+    if (time == NULL) {
+        printf("%-12s %ux%u, %d threads: %.2f ms per frame, no baseline\n",
+               scene->output_directory, scene->image_width,
+               scene->image_height, thread_count, frame_ms);
+        return passed;
+    }
+    double change = (frame_ms / time->frame_ms - 1.0) * 100.0;
+    bool fast_enough = change <= budget->max_slowdown;
+    printf("%-12s %ux%u, %d threads: %.2f ms per frame, baseline %.2f ms "
+           "(%+.1f%%) %s\n",
+           scene->output_directory, scene->image_width, scene->image_height,
+           thread_count, frame_ms, time->frame_ms, change,
+           fast_enough ? "ok" : "FAILED");
+    fflush(stdout);
+    return passed && fast_enough;
+}
+
+bool run_check(const struct scene_context *contexts, int count) {
+    const char *directory = getenv("ANIM_CHECK_DIR");
+    if (directory == NULL || directory[0] == '\0') {
+        directory = DEFAULT_CHECK_DIRECTORY;
+    }
+    bool record = get_bench_variable("ANIM_CHECK_RECORD", 0) != 0;
+    struct check_budget budget;
+    budget.tolerance = get_bench_variable("ANIM_CHECK_TOLERANCE", 2);
+    budget.min_psnr = get_check_variable("ANIM_CHECK_PSNR", 40.0f);
+    budget.max_different_pixels =
+        get_check_variable("ANIM_CHECK_DIFFERENT_PIXELS", 0.001f);
+    budget.max_slowdown = get_check_variable("ANIM_CHECK_SLOWDOWN", 10.0f);
+    int repetition_count = get_bench_variable("ANIM_BENCH_REPEAT", 5);
+    if (repetition_count < 1) {
+        repetition_count = 1;
+    }
+    double *repetition_times =
+        malloc(sizeof(double) * (size_t)repetition_count);
+    struct baseline *baseline = malloc(sizeof(struct baseline));
+    if (repetition_times == NULL || baseline == NULL) {
+        printf("Cannot allocate memory for the check.\n");
+        free(repetition_times);
+        free(baseline);
+        return false;
+    }
+    load_baseline(directory, baseline);
+    bool passed = true;
+    if (record && mkdir(directory, 0755) != 0 && errno != EEXIST) {
+        printf("Cannot create %s.\n", directory);
+        passed = false;
+    }
+    if (passed) {
+        printf("%s %d frames per clip in %s, %d timed repetitions, "
+               "depth pre-pass %s, level of detail error %g pixels.\n",
+               record ? "Recording" : "Checking", BENCH_FRAME_COUNT, directory,
+               repetition_count, get_depth_prepass() ? "on" : "off",
+               get_max_lod_error());
+        if (!record) {
+            printf("A frame may differ by more than %d in %g of its pixels "
+                   "and have a PSNR down to %g dB, a clip may be %g%% "
+                   "slower.\n",
+                   budget.tolerance, budget.max_different_pixels,
+                   budget.min_psnr, budget.max_slowdown);
+            printf("%-12s %5s %9s %8s %10s\n", "clip", "frame", "PSNR dB",
+                   "max diff", "diff > tol");
+        }
+        // Every clip is checked, so that one run reports all failures.
+        for (int i = 0; i < count; i++) {
+            passed = check_scene(contexts + i, directory, record, &budget,
+                                 repetition_count, repetition_times,
+                                 baseline) &&
+                     passed;
+        }
+    }
+    if (record && passed && !save_baseline(directory, baseline)) {
+        printf("Cannot write the baseline in %s.\n", directory);
+        passed = false;
+    }
+    free(repetition_times);
+    free(baseline);
+    printf("%s.\n", passed ? (record ? "Recorded" : "Check passed")
+                            : "Check failed");
+    return passed;
+}
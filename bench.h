@@ -0,0 +1,34 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdbool.h>
+
+#include "scene_renderer.h"
+
+// Renders a fixed set of frames of every scene over and over in this process,
+// without saving them, and prints the time per frame and the rates at which
+// triangles are submitted and fragments shaded. The frames are rendered
+// ANIM_BENCH_WARMUP times (default 1) before ANIM_BENCH_REPEAT timed
+// repetitions (default 5). ANIM_BENCH_THREADS is a comma-separated list of
+// tile thread counts to run the benchmark with, by default the one from
+// get_tile_thread_count(). Returns false if a render target cannot be
+// created.
+bool run_benchmark(const struct scene_context *contexts, int count);
+
+// Renders the benchmark frames of every scene and compares them with the
+// golden images in ANIM_CHECK_DIR (default "golden"), then times them like
+// the benchmark and compares the median time per frame with the baseline
+// stored there. A frame fails if its PSNR is below ANIM_CHECK_PSNR (default 40
+// dB) or more than ANIM_CHECK_DIFFERENT_PIXELS of its pixels (default 0.001)
+// differ by more than ANIM_CHECK_TOLERANCE (default 2) in a channel; a clip
+// fails if it is more than ANIM_CHECK_SLOWDOWN percent (default 10) slower.
+// With ANIM_CHECK_RECORD=1 the images and times are recorded instead. Returns
+// false if anything fails or cannot be checked.
+bool run_check(const struct scene_context *contexts, int count);
+
+#endif  // BENCH_H_
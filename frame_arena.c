@@ -0,0 +1,141 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#include "frame_arena.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define CACHE_LINE_SIZE 64
+// Blocks are at least this large, so that small frames fit in one block from
+// the start.
+#define MIN_BLOCK_SIZE ((size_t)1 << 20)
+
+static size_t round_up_to_cache_line(size_t size) {
+    return (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
+// The memory of a block follows its header, padded to a cache line.
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+};
+
+#define BLOCK_HEADER_SIZE \
+    ((sizeof(struct arena_block) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * \
+     CACHE_LINE_SIZE)
+
+struct frame_arena {
+    // Blocks in the order they are filled. Allocations come from current,
+    // which is NULL only while there are no blocks. The blocks after it are
+    // kept for reuse after a release.
+    struct arena_block *first;
+    struct arena_block *current;
+};
+
+static struct arena_block *create_block(size_t size) {
+    struct arena_block *block =
+        aligned_alloc(CACHE_LINE_SIZE, BLOCK_HEADER_SIZE + size);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+static void destroy_blocks(struct arena_block *block) {
+    while (block != NULL) {
+        struct arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+struct frame_arena *create_frame_arena(void) {
+    return calloc(1, sizeof(struct frame_arena));
+}
+
+void destroy_frame_arena(struct frame_arena *arena) {
+    if (arena == NULL) {
+        return;
+    }
+    destroy_blocks(arena->first);
+    free(arena);
+}
+
+void *allocate_from_arena(struct frame_arena *arena, size_t size) {
+    size = round_up_to_cache_line(size);
+    struct arena_block *block = arena->current;
+    if (block == NULL || block->size - block->used < size) {
+        // Move on to the next block, or put a large enough one in front of it.
+        struct arena_block *next = block != NULL ? block->next : NULL;
+        if (next == NULL || next->size < size) {
+            size_t block_size = block != NULL ? 2 * block->size : 0;
+            if (block_size < MIN_BLOCK_SIZE) {
+                block_size = MIN_BLOCK_SIZE;
+            }
+            if (block_size < size) {
+                block_size = size;
+            }
+            struct arena_block *grown = create_block(block_size);
+            if (grown == NULL) {
+                return NULL;
+            }
+            grown->next = next;
+            if (block != NULL) {
+                block->next = grown;
+            } else {
+                arena->first = grown;
+            }
+            next = grown;
+        }
+        next->used = 0;
+        arena->current = block = next;
+    }
+    void *memory = (uint8_t *)block + BLOCK_HEADER_SIZE + block->used;
+    block->used += size;
+    return memory;
+}
+
+struct arena_mark get_arena_mark(const struct frame_arena *arena) {
+    struct arena_mark mark = {arena->current, 0};
+    if (arena->current != NULL) {
+        mark.used = arena->current->used;
+    }
+    return mark;
+}
+
+void release_arena(struct frame_arena *arena, struct arena_mark mark) {
+    if (mark.block == NULL) {
+        // Nothing was allocated when the mark was taken.
+        mark.block = arena->first;
+    }
+    arena->current = mark.block;
+    if (mark.block != NULL) {
+        mark.block->used = mark.used;
+    }
+}
+
+void reset_frame_arena(struct frame_arena *arena) {
+    if (arena->first != NULL && arena->first->next != NULL) {
+        size_t size = 0;
+        for (struct arena_block *block = arena->first; block != NULL;
+             block = block->next) {
+            size += block->size;
+        }
+        destroy_blocks(arena->first);
+        // If the merged block cannot be allocated, the next frame grows the
+        // arena again.
+        arena->first = create_block(size);
+    }
+    arena->current = arena->first;
+    if (arena->first != NULL) {
+        arena->first->used = 0;
+    }
+}
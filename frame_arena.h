@@ -0,0 +1,46 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#ifndef FRAME_ARENA_H_
+#define FRAME_ARENA_H_
+
+#include <stddef.h>
+
+// A bump allocator for the memory that is only needed while a frame is
+// rendered, such as shaded vertices, culled indices and tile bins. Nothing is
+// freed on its own; allocations are released all at once, so the render loop
+// stops calling malloc() once the arena has grown to fit the largest frame.
+// Only the thread that drives the frame may allocate from it.
+struct frame_arena;
+
+struct arena_block;
+
+// A point in the allocations of an arena to release back to.
+struct arena_mark {
+    struct arena_block *block;
+    size_t used;
+};
+
+// Creates an empty arena. Returns NULL if the memory cannot be allocated.
+struct frame_arena *create_frame_arena(void);
+
+void destroy_frame_arena(struct frame_arena *arena);
+
+// Returns size bytes aligned to a cache line, which stay valid until they are
+// released. Returns NULL if the arena is full and cannot grow.
+void *allocate_from_arena(struct frame_arena *arena, size_t size);
+
+struct arena_mark get_arena_mark(const struct frame_arena *arena);
+
+// Releases everything allocated since the mark was taken, keeping the memory
+// for the next allocations.
+void release_arena(struct frame_arena *arena, struct arena_mark mark);
+
+// Releases all allocations. If they did not fit in one block, the blocks are
+// replaced by a single one large enough for all of them, so that the next
+// frame of the same size fits without growing.
+void reset_frame_arena(struct frame_arena *arena);
+
+#endif  // FRAME_ARENA_H_
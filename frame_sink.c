@@ -0,0 +1,237 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "frame_sink.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "graphics/texture.h"
+#include "utilities/image.h"
+
+// Longest image path, including the terminating null character.
+#define IMAGE_PATH_SIZE 256
+
+enum frame_sink_type {
+    FRAME_SINK_IMAGES,
+    FRAME_SINK_STREAM,
+    FRAME_SINK_RAW_FILE,
+};
+
+struct frame_sink {
+    enum frame_sink_type type;
+    const char *image_directory;
+    const char *image_name_format;
+    uint32_t width, height;
+    int first_frame, frame_stride;
+    int fd;
+};
+
+// The standard output the process started with, once the first sink that
+// streams to it has moved everything else printed to the standard error.
+// Every such sink writes to its own copy, so closing one keeps the others.
+static int standard_output = -1;
+
+// Returns a copy of the standard output the process started with, or -1 if
+// it cannot be duplicated.
+static int open_standard_output(void) {
+    if (standard_output < 0) {
+        // Keep the frames to ourselves and send everything else that is
+        // printed to the standard error.
+        fflush(stdout);
+        int output = dup(STDOUT_FILENO);
+        if (output < 0) {
+            return -1;
+        }
+        if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            close(output);
+            return -1;
+        }
+        standard_output = output;
+    }
+    return dup(standard_output);
+}
+
+struct frame_sink *open_frame_sink(const char *image_directory,
+                                   const char *image_name_format,
+                                   uint32_t width, uint32_t height,
+                                   int first_frame, int frame_stride) {
+    struct frame_sink *sink = malloc(sizeof(struct frame_sink));
+    if (sink == NULL) {
+        return NULL;
+    }
+    const char *directory = getenv("ANIM_OUTPUT_DIR");
+    sink->image_directory = directory != NULL && directory[0] != '\0'
+                                ? directory
+                                : image_directory;
+    sink->image_name_format = image_name_format;
+    sink->width = width;
+    sink->height = height;
+    sink->first_frame = first_frame;
+    sink->frame_stride = frame_stride > 0 ? frame_stride : 1;
+    sink->fd = -1;
+    const char *output = getenv("ANIM_OUTPUT");
+    if (output == NULL || output[0] == '\0') {
+        sink->type = FRAME_SINK_IMAGES;
+        if (mkdir(sink->image_directory, 0755) != 0 && errno != EEXIST) {
+            close_frame_sink(sink);
+            return NULL;
+        }
+        return sink;
+    }
+    if (strcmp(output, "-") == 0) {
+        sink->type = FRAME_SINK_STREAM;
+        sink->fd = open_standard_output();
+        if (sink->fd < 0) {
+            close_frame_sink(sink);
+            return NULL;
+        }
+        return sink;
+    }
+    sink->fd = open(output, O_WRONLY | O_CREAT, 0644);
+    struct stat status;
+    if (sink->fd < 0 || fstat(sink->fd, &status) != 0) {
+        close_frame_sink(sink);
+        return NULL;
+    }
+    if (S_ISREG(status.st_mode)) {
+        sink->type = FRAME_SINK_RAW_FILE;
+        // Drop frames left over from a longer sequence.
+        if (ftruncate(sink->fd, 0) != 0) {
+            close_frame_sink(sink);
+            return NULL;
+        }
+    } else {
+        sink->type = FRAME_SINK_STREAM;
+    }
+    return sink;
+}
+
+void close_frame_sink(struct frame_sink *sink) {
+    if (sink == NULL) {
+        return;
+    }
+    if (sink->fd >= 0) {
+        close(sink->fd);
+    }
+    free(sink);
+}
+
+bool is_frame_sink_sequential(const struct frame_sink *sink) {
+    return sink->type == FRAME_SINK_STREAM;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+static bool write_all_at(int fd, const uint8_t *data, size_t size,
+                         off_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= (size_t)written;
+        offset += written;
+    }
+    return true;
+}
+
+// Writes the path of the image of the frame to path. Returns false if it does
+// not fit.
+static bool get_image_path(const struct frame_sink *sink, int frame,
+                           char path[IMAGE_PATH_SIZE]) {
+    int length =
+        snprintf(path, IMAGE_PATH_SIZE, "%s/", sink->image_directory);
+    if (length < 0 || length >= IMAGE_PATH_SIZE) {
+        return false;
+    }
+    int name_length = snprintf(path + length, IMAGE_PATH_SIZE - length,
+                               sink->image_name_format, frame);
+    return name_length >= 0 && name_length < IMAGE_PATH_SIZE - length;
+}
+
+bool has_frame(const struct frame_sink *sink, int frame) {
+    char path[IMAGE_PATH_SIZE];
+    struct stat status;
+    return sink->type == FRAME_SINK_IMAGES &&
+           get_image_path(sink, frame, path) && stat(path, &status) == 0 &&
+           S_ISREG(status.st_mode) && status.st_size > 0;
+}
+
+// Saves the image under a temporary name first, so that a frame interrupted
+// while being written is not mistaken for a finished one.
+static bool write_image(const struct frame_sink *sink,
+                        const struct texture *color_buffer, int frame) {
+    char path[IMAGE_PATH_SIZE];
+    char temporary_path[IMAGE_PATH_SIZE + 32];
+    if (!get_image_path(sink, frame, path)) {
+        return false;
+    }
+    snprintf(temporary_path, sizeof(temporary_path), "%s.%ld", path,
+             (long)getpid());
+    if (!save_image(color_buffer, temporary_path, true)) {
+        remove(temporary_path);
+        return false;
+    }
+    if (rename(temporary_path, path) != 0) {
+        remove(temporary_path);
+        return false;
+    }
+    return true;
+}
+
+bool write_frame(const struct frame_sink *sink,
+                 const struct texture *color_buffer, int frame) {
+    if (sink->type == FRAME_SINK_IMAGES) {
+        return write_image(sink, color_buffer, frame);
+    }
+    // Texture rows are stored bottom-up.
+    size_t row_size = (size_t)sink->width * 4;
+    const uint8_t *pixels = color_buffer->pixels;
+    int index = (frame - sink->first_frame) / sink->frame_stride;
+    off_t frame_offset = (off_t)index * (off_t)(row_size * sink->height);
+    for (uint32_t row = 0; row < sink->height; row++) {
+        const uint8_t *data = pixels + (sink->height - 1 - row) * row_size;
+        bool result;
+        if (sink->type == FRAME_SINK_STREAM) {
+            result = write_all(sink->fd, data, row_size);
+        } else {
+            result = write_all_at(sink->fd, data, row_size,
+                                  frame_offset + (off_t)(row * row_size));
+        }
+        if (!result) {
+            return false;
+        }
+    }
+    return true;
+}
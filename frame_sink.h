@@ -0,0 +1,54 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#ifndef FRAME_SINK_H_
+#define FRAME_SINK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "graphics/texture.h"
+
+// Where finished frames go, selected by the ANIM_OUTPUT environment variable:
+// - Unset or empty: one image file per frame, named by a printf format, in a
+//   directory that the ANIM_OUTPUT_DIR environment variable can override.
+// - "-": raw RGBA frames streamed to the standard output, top row first.
+//   From the first such sink on, messages printed to the standard output go
+//   to the standard error instead, and the frames of all such sinks go to the
+//   standard output the process started with.
+// - The path of a named pipe or character device: raw frames streamed to it.
+// - Any other path: a single raw sequence file that holds frames first,
+//   first + stride, ... one after another, so frame i is stored at offset
+//   (i - first) / stride * width * height * 4 and frames can be written in any
+//   order.
+struct frame_sink;
+
+// Opens the sink selected by ANIM_OUTPUT. image_directory, which is created if
+// it does not exist, and image_name_format, which receives the frame number,
+// are only used for image files. first_frame and frame_stride are only used
+// for raw sequence files. Opening a named pipe blocks until a reader opens it.
+// Returns NULL if the output cannot be opened.
+struct frame_sink *open_frame_sink(const char *image_directory,
+                                   const char *image_name_format,
+                                   uint32_t width, uint32_t height,
+                                   int first_frame, int frame_stride);
+
+void close_frame_sink(struct frame_sink *sink);
+
+// Returns true if the sink is a stream, which must get its frames in order.
+bool is_frame_sink_sequential(const struct frame_sink *sink);
+
+// Returns true if the sink already holds the frame from an earlier run. Only
+// image files are checked; they are written under a temporary name and
+// renamed, so a frame that exists is complete.
+bool has_frame(const struct frame_sink *sink, int frame);
+
+// Writes the sRGB color buffer as the given frame. Several processes may write
+// different frames of a sink opened before they were forked, unless it is
+// sequential. Returns false if the frame cannot be written.
+bool write_frame(const struct frame_sink *sink,
+                 const struct texture *color_buffer, int frame);
+
+#endif  // FRAME_SINK_H_
@@ -0,0 +1,213 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "frame_workers.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "frame_sink.h"
+#include "render_target.h"
+#include "tile_renderer.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAS_FORK 1
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#else
+#define HAS_FORK 0
+#endif
+
+static int get_frame_variable(const char *name, int default_value) {
+    const char *value = getenv(name);
+    return value != NULL && value[0] != '\0' ? atoi(value) : default_value;
+}
+
+void clamp_frame_range(struct frame_range *range, int frame_count) {
+    if (range->first < 0) {
+        range->first = 0;
+    }
+    if (range->end > frame_count) {
+        range->end = frame_count;
+    }
+    if (range->stride < 1) {
+        range->stride = 1;
+    }
+}
+
+struct frame_range get_frame_range(int frame_count) {
+    struct frame_range range;
+    range.first = get_frame_variable("ANIM_FIRST_FRAME", 0);
+    range.end = get_frame_variable("ANIM_END_FRAME", frame_count);
+    range.stride = get_frame_variable("ANIM_FRAME_STRIDE", 1);
+    clamp_frame_range(&range, frame_count);
+    return range;
+}
+
+int get_frame_range_count(const struct frame_range *range) {
+    if (range->end <= range->first) {
+        return 0;
+    }
+    return (range->end - range->first + range->stride - 1) / range->stride;
+}
+
+int get_worker_count(void) {
+    const char *value = getenv("ANIM_WORKERS");
+    if (value != NULL) {
+        int count = atoi(value);
+        return count > 0 ? count : 1;
+    }
+#if HAS_FORK
+    // Every worker renders on its tile threads, so share the processors out
+    // between them instead of starting a worker per processor.
+    long count = sysconf(_SC_NPROCESSORS_ONLN) / get_tile_thread_count();
+    return count > 0 ? (int)count : 1;
+#else
+    return 1;
+#endif
+}
+
+// A frame of a job and the worker that renders it.
+struct scheduled_frame {
+    int job;
+    int frame;
+    int worker;
+};
+
+// Renders the frames scheduled for the worker in order, switching render
+// targets only when the next job's settings need a different one.
+static bool render_frame_list(const struct frame_job *jobs,
+                              const struct scheduled_frame *frames,
+                              int frame_count, int worker) {
+    struct render_target *target = NULL;
+    bool result = true;
+    for (int i = 0; i < frame_count; i++) {
+        if (frames[i].worker != worker) {
+            continue;
+        }
+        const struct frame_job *job = jobs + frames[i].job;
+        if (target != NULL && !reuse_render_target(target, job->settings)) {
+            destroy_render_target(target);
+            target = NULL;
+        }
+        if (target == NULL) {
+            target = create_render_target(job->settings);
+            if (target == NULL) {
+                printf("Cannot create render target.\n");
+                result = false;
+                break;
+            }
+        }
+        job->render_frame(target, frames[i].frame, job->context);
+    }
+    destroy_render_target(target);
+    return result;
+}
+
+// Lists the frames of all jobs that their frame sinks do not hold yet and
+// deals them out to the workers. Returns the number of frames, or -1 if the
+// memory cannot be allocated.
+static int schedule_frames(const struct frame_job *jobs, int job_count,
+                           int worker_count, struct scheduled_frame **result) {
+    size_t capacity = 1;
+    for (int i = 0; i < job_count; i++) {
+        capacity += (size_t)get_frame_range_count(&jobs[i].range);
+    }
+    struct scheduled_frame *frames =
+        malloc(sizeof(struct scheduled_frame) * capacity);
+    if (frames == NULL) {
+        return -1;
+    }
+    int frame_count = 0;
+    int next_worker = 0;
+    for (int i = 0; i < job_count; i++) {
+        const struct frame_job *job = jobs + i;
+        bool sequential = is_frame_sink_sequential(job->settings->frame_sink);
+        for (int frame = job->range.first; frame < job->range.end;
+             frame += job->range.stride) {
+            if (has_frame(job->settings->frame_sink, frame)) {
+                continue;
+            }
+            struct scheduled_frame *scheduled = frames + frame_count++;
+            scheduled->job = i;
+            scheduled->frame = frame;
+            if (sequential) {
+                scheduled->worker = 0;
+            } else {
+                scheduled->worker = next_worker;
+                next_worker = (next_worker + 1) % worker_count;
+            }
+        }
+    }
+    *result = frames;
+    return frame_count;
+}
+
+bool render_jobs(const struct frame_job *jobs, int job_count,
+                 int worker_count) {
+    if (worker_count < 1) {
+        worker_count = 1;
+    }
+    struct scheduled_frame *frames;
+    int frame_count = schedule_frames(jobs, job_count, worker_count, &frames);
+    if (frame_count < 0) {
+        printf("Cannot allocate memory for the frame list.\n");
+        return false;
+    }
+    // Only start the workers that got frames.
+    int used_worker_count = 0;
+    for (int i = 0; i < frame_count; i++) {
+        if (frames[i].worker >= used_worker_count) {
+            used_worker_count = frames[i].worker + 1;
+        }
+    }
+    worker_count = used_worker_count;
+    bool result = true;
+#if HAS_FORK
+    if (worker_count > 1) {
+        // Anything still buffered would otherwise be written once per worker.
+        fflush(NULL);
+        int started = 0;
+        for (; started < worker_count; started++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                bool worker_result =
+                    render_frame_list(jobs, frames, frame_count, started);
+                fflush(NULL);
+                _exit(worker_result ? EXIT_SUCCESS : EXIT_FAILURE);
+            }
+            if (pid < 0) {
+                break;
+            }
+        }
+        result = started == worker_count;
+        for (int i = 0; i < started; i++) {
+            int status;
+            if (wait(&status) < 0 || !WIFEXITED(status) ||
+                WEXITSTATUS(status) != EXIT_SUCCESS) {
+                result = false;
+            }
+        }
+        if (!result) {
+            printf("A render worker failed.\n");
+        }
+        free(frames);
+        return result;
+    }
+#endif
+    // Without workers every frame is rendered here, whichever worker it was
+    // dealt to.
+    for (int i = 0; i < frame_count; i++) {
+        frames[i].worker = 0;
+    }
+    result = render_frame_list(jobs, frames, frame_count, 0);
+    free(frames);
+    return result;
+}
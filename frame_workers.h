@@ -0,0 +1,65 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#ifndef FRAME_WORKERS_H_
+#define FRAME_WORKERS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "render_target.h"
+
+// Renders and outputs a single frame into the worker's own render target.
+typedef void (*render_frame_function)(struct render_target *target, int frame,
+                                      void *context);
+
+// The frames first, first + stride, ... that are less than end.
+struct frame_range {
+    int first;
+    int end;
+    int stride;
+};
+
+// Returns the range of the frames in [0, frame_count) to render, narrowed by
+// the ANIM_FIRST_FRAME, ANIM_END_FRAME (exclusive) and ANIM_FRAME_STRIDE
+// environment variables, so that a clip can be split across machines.
+struct frame_range get_frame_range(int frame_count);
+
+// Narrows the range to the frames in [0, frame_count) and makes its stride
+// at least 1.
+void clamp_frame_range(struct frame_range *range, int frame_count);
+
+// Returns the number of frames in the range.
+int get_frame_range_count(const struct frame_range *range);
+
+// Returns the number of workers to render with: the ANIM_WORKERS environment
+// variable if it is set, otherwise the number of online processors divided by
+// the tile threads of each worker.
+int get_worker_count(void);
+
+// The frames of one clip to render with render_jobs().
+struct frame_job {
+    const struct render_target_settings *settings;
+    struct frame_range range;
+    render_frame_function render_frame;
+    void *context;
+};
+
+// Calls the render_frame of every job for each frame in its range that the
+// frame sink of its settings does not hold yet, so an interrupted render
+// resumes where it stopped. The frames of all jobs are dealt out to a single
+// pool of worker_count processes, so the rasterizer's global state is never
+// shared between two frames in flight, and the workers move on to the next job
+// without waiting for the last frames of the previous one. Each process
+// creates its own render target from the settings and keeps it from one job
+// to the next if their settings allow it. The frames of jobs with a
+// sequential frame sink all go to the first worker, in job order. Everything
+// render_frame reads besides its render target must be set up before this is
+// called and must not be modified by render_frame. Returns false if any worker
+// failed.
+bool render_jobs(const struct frame_job *jobs, int job_count,
+                 int worker_count);
+
+#endif  // FRAME_WORKERS_H_
@@ -0,0 +1,152 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#include "frame_writer.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "graphics/framebuffer.h"
+#include "graphics/texture.h"
+
+#include "frame_sink.h"
+#include "task_scheduler.h"
+
+struct queued_frame {
+    const struct frame_sink *sink;
+    struct texture *color_buffer;
+    int frame;
+};
+
+struct frame_writer {
+    struct task_scheduler *scheduler;
+    // The task that writes the queued frames, if there is one.
+    struct task_group group;
+    pthread_mutex_t mutex;
+    // Signaled whenever a buffer becomes free.
+    pthread_cond_t changed;
+    // Set while a task writes the queue. A single task writes all frames
+    // queued while it runs, so they are written in order.
+    bool writing;
+    // Holds every buffer not being rendered into, so neither ring fills up.
+    int capacity;
+    // Ring of frames waiting to be saved. The frame at queue_head stays
+    // queued until it is written.
+    struct queued_frame *queue;
+    int queue_head, queue_count;
+    struct texture **free_buffers;
+    int free_count;
+};
+
+static void write_frames(void *argument, uint32_t index, int thread) {
+    (void)index;
+    (void)thread;
+    struct frame_writer *writer = argument;
+    pthread_mutex_lock(&writer->mutex);
+    while (writer->queue_count > 0) {
+        struct queued_frame *frame = writer->queue + writer->queue_head;
+        // The frame cannot be modified while it is queued, so save it
+        // unlocked.
+        pthread_mutex_unlock(&writer->mutex);
+        if (!write_frame(frame->sink, frame->color_buffer, frame->frame)) {
+            printf("Cannot write frame %d.\n", frame->frame);
+        }
+        pthread_mutex_lock(&writer->mutex);
+        writer->free_buffers[writer->free_count++] = frame->color_buffer;
+        writer->queue_head = (writer->queue_head + 1) % writer->capacity;
+        writer->queue_count--;
+        pthread_cond_broadcast(&writer->changed);
+    }
+    writer->writing = false;
+    pthread_mutex_unlock(&writer->mutex);
+}
+
+// Starts a task to write the queue unless one is running. Must be called with
+// the mutex held. If the task cannot be queued, the frames are written on the
+// calling thread.
+static void start_writing(struct frame_writer *writer) {
+    if (writer->writing) {
+        return;
+    }
+    writer->writing = true;
+    if (!submit_tasks(writer->scheduler, &writer->group, write_frames, writer,
+                      1)) {
+        pthread_mutex_unlock(&writer->mutex);
+        write_frames(writer, 0, 0);
+        pthread_mutex_lock(&writer->mutex);
+    }
+}
+
+struct frame_writer *create_frame_writer(uint32_t width, uint32_t height,
+                                         int buffer_count,
+                                         struct task_scheduler *scheduler) {
+    if (buffer_count < 2) {
+        return NULL;
+    }
+    struct frame_writer *writer = calloc(1, sizeof(struct frame_writer));
+    if (writer == NULL) {
+        return NULL;
+    }
+    writer->scheduler = scheduler;
+    init_task_group(&writer->group);
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->changed, NULL);
+    writer->capacity = buffer_count - 1;
+    writer->queue = malloc(sizeof(struct queued_frame) * writer->capacity);
+    writer->free_buffers = calloc(writer->capacity, sizeof(struct texture *));
+    if (writer->queue == NULL || writer->free_buffers == NULL) {
+        destroy_frame_writer(writer);
+        return NULL;
+    }
+    for (; writer->free_count < writer->capacity; writer->free_count++) {
+        struct texture *buffer =
+            create_texture(TEXTURE_FORMAT_SRGB8_A8, width, height);
+        if (buffer == NULL) {
+            destroy_frame_writer(writer);
+            return NULL;
+        }
+        writer->free_buffers[writer->free_count] = buffer;
+    }
+    return writer;
+}
+
+void destroy_frame_writer(struct frame_writer *writer) {
+    if (writer == NULL) {
+        return;
+    }
+    wait_for_tasks(writer->scheduler, &writer->group);
+    pthread_mutex_destroy(&writer->mutex);
+    pthread_cond_destroy(&writer->changed);
+    for (int i = 0; i < writer->free_count; i++) {
+        destroy_texture(writer->free_buffers[i]);
+    }
+    free(writer->queue);
+    free(writer->free_buffers);
+    free(writer);
+}
+
+void queue_frame(struct frame_writer *writer, const struct frame_sink *sink,
+                 struct framebuffer *framebuffer, struct texture **color_buffer,
+                 int frame) {
+    pthread_mutex_lock(&writer->mutex);
+    while (writer->free_count == 0) {
+        pthread_cond_wait(&writer->changed, &writer->mutex);
+    }
+    struct texture *free_buffer = writer->free_buffers[--writer->free_count];
+    int tail = (writer->queue_head + writer->queue_count) % writer->capacity;
+    writer->queue[tail].sink = sink;
+    writer->queue[tail].color_buffer = *color_buffer;
+    writer->queue[tail].frame = frame;
+    writer->queue_count++;
+    start_writing(writer);
+    pthread_mutex_unlock(&writer->mutex);
+
+    *color_buffer = free_buffer;
+    attach_texture_to_framebuffer(framebuffer, COLOR_ATTACHMENT, free_buffer);
+}
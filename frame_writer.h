@@ -0,0 +1,47 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#ifndef FRAME_WRITER_H_
+#define FRAME_WRITER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "graphics/framebuffer.h"
+#include "graphics/texture.h"
+
+#include "frame_sink.h"
+#include "task_scheduler.h"
+
+// Saves rendered frames in the background, as tasks on the threads of a task
+// scheduler. The writer hands out a fixed set of color buffers: while one is
+// being rendered into, the others wait in a bounded queue or are being
+// written, so encoding and disk writes overlap the rendering of the following
+// frames without using more memory.
+struct frame_writer;
+
+// Creates a writer with buffer_count - 1 sRGB color buffers of the given size
+// besides the one the caller renders into, which writes on the threads of the
+// scheduler. Frames are written in the order they are queued. The writer must
+// only be used from thread 0 of the scheduler, which must outlive it. Returns
+// NULL if buffer_count is less than 2 or the resources cannot be created.
+struct frame_writer *create_frame_writer(uint32_t width, uint32_t height,
+                                         int buffer_count,
+                                         struct task_scheduler *scheduler);
+
+// Waits until all queued frames are written, then destroys the buffers the
+// writer holds.
+void destroy_frame_writer(struct frame_writer *writer);
+
+// Queues *color_buffer to be written to the sink as the given frame. The sink
+// must stay open until the frame is written. This replaces the buffer with a
+// free buffer of the writer and attaches that buffer to the framebuffer. The
+// queued buffer belongs to the writer until it is handed out again. Blocks
+// while every buffer is queued.
+void queue_frame(struct frame_writer *writer, const struct frame_sink *sink,
+                 struct framebuffer *framebuffer, struct texture **color_buffer,
+                 int frame);
+
+#endif  // FRAME_WRITER_H_
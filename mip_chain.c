@@ -0,0 +1,287 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mip_chain.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "graphics/texture.h"
+#include "utilities/image.h"
+
+#define MIP_FILE_MAGIC "FRMIPS"
+#define MIP_FILE_VERSION 1
+#define MIP_FILE_SUFFIX ".mips"
+
+// Layout of a mip chain file: this header, then the pixels of every level
+// from the largest to the smallest, rows in texture order. Like baked mesh
+// files, it is only meant to be read back by the machine that wrote it.
+struct mip_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t level_count;
+};
+
+static size_t get_pixel_size(enum texture_format format) {
+    switch (format) {
+        case TEXTURE_FORMAT_R8:
+            return 1;
+        case TEXTURE_FORMAT_DEPTH_FLOAT:
+            return sizeof(float);
+        default:
+            return 4;
+    }
+}
+
+static uint32_t get_level_count(uint32_t width, uint32_t height) {
+    uint32_t count = 1;
+    while ((width > 1 || height > 1) && count < MAX_MIP_LEVEL_COUNT) {
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+        count++;
+    }
+    return count;
+}
+
+static float srgb_to_linear(float value) {
+    return value <= 0.04045f ? value / 12.92f
+                             : powf((value + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linear_to_srgb(float value) {
+    return value <= 0.0031308f ? value * 12.92f
+                               : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+}
+
+// Averages each 2x2 block of the source into one texel of the destination,
+// which is half as large, rounded down, in each dimension. The color channels
+// of sRGB textures are averaged in linear space.
+static void downsample(struct texture *destination,
+                       const struct texture *source) {
+    size_t pixel_size = get_pixel_size(source->format);
+    bool srgb = source->format == TEXTURE_FORMAT_SRGB8_A8;
+    float srgb_table[256];
+    if (srgb) {
+        for (int i = 0; i < 256; i++) {
+            srgb_table[i] = srgb_to_linear(i / 255.0f);
+        }
+    }
+    const uint8_t *source_pixels = source->pixels;
+    uint8_t *destination_pixels = destination->pixels;
+    for (uint32_t y = 0; y < destination->height; y++) {
+        uint32_t y0 = y * 2;
+        uint32_t y1 = y0 + 1 < source->height ? y0 + 1 : y0;
+        for (uint32_t x = 0; x < destination->width; x++) {
+            uint32_t x0 = x * 2;
+            uint32_t x1 = x0 + 1 < source->width ? x0 + 1 : x0;
+            const uint8_t *texels[4] = {
+                source_pixels + ((size_t)y0 * source->width + x0) * pixel_size,
+                source_pixels + ((size_t)y0 * source->width + x1) * pixel_size,
+                source_pixels + ((size_t)y1 * source->width + x0) * pixel_size,
+                source_pixels + ((size_t)y1 * source->width + x1) * pixel_size};
+            uint8_t *texel = destination_pixels +
+                             ((size_t)y * destination->width + x) * pixel_size;
+            for (size_t c = 0; c < pixel_size; c++) {
+                if (srgb && c < 3) {
+                    float sum = 0.0f;
+                    for (int i = 0; i < 4; i++) {
+                        sum += srgb_table[texels[i][c]];
+                    }
+                    float value = linear_to_srgb(sum * 0.25f);
+                    texel[c] = (uint8_t)(value * 255.0f + 0.5f);
+                } else {
+                    unsigned sum = 2;  // Rounds to nearest.
+                    for (int i = 0; i < 4; i++) {
+                        sum += texels[i][c];
+                    }
+                    texel[c] = (uint8_t)(sum / 4);
+                }
+            }
+        }
+    }
+}
+
+static struct mip_chain *create_mip_chain(enum texture_format format,
+                                          uint32_t width, uint32_t height,
+                                          uint32_t level_count) {
+    struct mip_chain *chain = calloc(1, sizeof(struct mip_chain));
+    if (chain == NULL) {
+        return NULL;
+    }
+    for (; chain->level_count < level_count; chain->level_count++) {
+        struct texture *level = create_texture(format, width, height);
+        if (level == NULL) {
+            destroy_mip_chain(chain);
+            return NULL;
+        }
+        chain->levels[chain->level_count] = level;
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+    }
+    return chain;
+}
+
+static size_t get_level_size(const struct texture *level) {
+    return (size_t)level->width * level->height *
+           get_pixel_size(level->format);
+}
+
+// Reads the cache if it is at least as new as the image and matches the
+// requested color space.
+static struct mip_chain *read_mip_file(const char *path,
+                                       const char *image_path, bool srgb) {
+    struct stat status, image_status;
+    if (stat(path, &status) != 0 ||
+        (stat(image_path, &image_status) == 0 &&
+         image_status.st_mtime > status.st_mtime)) {
+        return NULL;
+    }
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    struct mip_file_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, MIP_FILE_MAGIC, sizeof(MIP_FILE_MAGIC)) != 0 ||
+        header.version != MIP_FILE_VERSION ||
+        (header.format == TEXTURE_FORMAT_SRGB8_A8) != srgb ||
+        header.level_count == 0 || header.width == 0 || header.height == 0 ||
+        header.level_count != get_level_count(header.width, header.height)) {
+        fclose(file);
+        return NULL;
+    }
+    struct mip_chain *chain =
+        create_mip_chain((enum texture_format)header.format, header.width,
+                         header.height, header.level_count);
+    if (chain == NULL) {
+        fclose(file);
+        return NULL;
+    }
+    // The public layout of struct texture lets the file be read straight into
+    // the texture storage.
+    for (uint32_t i = 0; i < chain->level_count; i++) {
+        struct texture *level = chain->levels[i];
+        size_t size = get_level_size(level);
+        if (fread(level->pixels, 1, size, file) != size) {
+            fclose(file);
+            destroy_mip_chain(chain);
+            return NULL;
+        }
+    }
+    fclose(file);
+    return chain;
+}
+
+// Writes to a temporary file first and renames it, so that processes loading
+// the image at the same time never see a partial file.
+static bool write_mip_file(const struct mip_chain *chain, const char *path) {
+    size_t length = strlen(path);
+    char *temporary_path = malloc(length + 32);
+    if (temporary_path == NULL) {
+        return false;
+    }
+    snprintf(temporary_path, length + 32, "%s.%ld", path, (long)getpid());
+    FILE *file = fopen(temporary_path, "wb");
+    if (file == NULL) {
+        free(temporary_path);
+        return false;
+    }
+    const struct texture *base = chain->levels[0];
+    struct mip_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MIP_FILE_MAGIC, sizeof(MIP_FILE_MAGIC));
+    header.version = MIP_FILE_VERSION;
+    header.format = (uint32_t)base->format;
+    header.width = base->width;
+    header.height = base->height;
+    header.level_count = chain->level_count;
+    bool result = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (uint32_t i = 0; result && i < chain->level_count; i++) {
+        const struct texture *level = chain->levels[i];
+        size_t size = get_level_size(level);
+        result = fwrite(level->pixels, 1, size, file) == size;
+    }
+    result = fclose(file) == 0 && result;
+    result = result && rename(temporary_path, path) == 0;
+    if (!result) {
+        remove(temporary_path);
+    }
+    free(temporary_path);
+    return result;
+}
+
+static struct mip_chain *build_mip_chain(const char *image_path, bool srgb) {
+    struct texture *image = load_image(image_path, srgb);
+    if (image == NULL) {
+        return NULL;
+    }
+    uint32_t level_count = get_level_count(image->width, image->height);
+    struct mip_chain *chain =
+        create_mip_chain(image->format, image->width, image->height,
+                         level_count);
+    if (chain == NULL) {
+        destroy_texture(image);
+        return NULL;
+    }
+    destroy_texture(chain->levels[0]);
+    chain->levels[0] = image;
+    for (uint32_t i = 1; i < level_count; i++) {
+        downsample(chain->levels[i], chain->levels[i - 1]);
+    }
+    return chain;
+}
+
+struct mip_chain *load_mip_chain(const char *path, bool srgb) {
+    size_t length = strlen(path);
+    char *mip_path = malloc(length + sizeof(MIP_FILE_SUFFIX));
+    if (mip_path == NULL) {
+        return NULL;
+    }
+    memcpy(mip_path, path, length);
+    memcpy(mip_path + length, MIP_FILE_SUFFIX, sizeof(MIP_FILE_SUFFIX));
+    struct mip_chain *chain = read_mip_file(mip_path, path, srgb);
+    if (chain == NULL) {
+        chain = build_mip_chain(path, srgb);
+        // The cache only saves time on the next start, so failing to write
+        // it is not an error.
+        if (chain != NULL && !write_mip_file(chain, mip_path)) {
+            printf("Cannot write %s.\n", mip_path);
+        }
+    }
+    free(mip_path);
+    return chain;
+}
+
+struct mip_chain *create_constant_mip_chain(enum texture_format format,
+                                            const void *pixel) {
+    struct mip_chain *chain = create_mip_chain(format, 1, 1, 1);
+    if (chain != NULL) {
+        set_texture_pixels(chain->levels[0], pixel);
+    }
+    return chain;
+}
+
+void destroy_mip_chain(struct mip_chain *chain) {
+    if (chain == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < chain->level_count; i++) {
+        destroy_texture(chain->levels[i]);
+    }
+    free(chain);
+}
@@ -0,0 +1,39 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#ifndef MIP_CHAIN_H_
+#define MIP_CHAIN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "graphics/texture.h"
+
+// Enough levels for textures up to 32768 texels wide.
+#define MAX_MIP_LEVEL_COUNT 16
+
+// A texture and copies of it that halve in size down to 1x1. Level 0 is the
+// texture itself.
+struct mip_chain {
+    uint32_t level_count;
+    struct texture *levels[MAX_MIP_LEVEL_COUNT];
+};
+
+// Loads an image like load_image() and builds its mip chain with a box filter,
+// in linear space for sRGB images. The decoded levels are cached in a binary
+// file next to the image, with ".mips" appended to the name, which is read
+// straight into the textures on later runs. The cache is rebuilt if it is
+// missing, invalid or older than the image. Returns NULL if the image cannot
+// be loaded.
+struct mip_chain *load_mip_chain(const char *path, bool srgb);
+
+// Creates a chain of a single 1x1 texture with the given pixel, used where a
+// scene has no map. Returns NULL if the texture cannot be created.
+struct mip_chain *create_constant_mip_chain(enum texture_format format,
+                                            const void *pixel);
+
+void destroy_mip_chain(struct mip_chain *chain);
+
+#endif  // MIP_CHAIN_H_
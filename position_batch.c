@@ -0,0 +1,183 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#include "position_batch.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "math/matrix.h"
+#include "math/vector.h"
+#include "shaders/standard.h"
+
+// The projection needs SSE2 for its integer masks and the AArch64 NEON for
+// its division.
+#if defined(__SSE2__) || defined(_M_X64)
+#define HAS_SSE 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define HAS_NEON 1
+#include <arm_neon.h>
+#endif
+
+_Static_assert(POSITION_BATCH_SIZE % 4 == 0,
+               "Batches must hold whole SIMD registers.");
+
+// Returns the position of entry i of the batch.
+static const vector3 *get_position(
+    const struct standard_vertex_attribute *vertices, const uint32_t *indices,
+    uint32_t i) {
+    return &vertices[indices != NULL ? indices[i] : i].position;
+}
+
+#if defined(HAS_SSE) || defined(HAS_NEON)
+// Gathers the coordinates of the four positions from entry first on, one row
+// per coordinate. Lanes past the end repeat the last position, whose results
+// land in the unused entries of the batch.
+static void gather_positions(const struct standard_vertex_attribute *vertices,
+                             const uint32_t *indices, uint32_t count,
+                             uint32_t first, float lanes[3][4]) {
+    for (uint32_t lane = 0; lane < 4; lane++) {
+        uint32_t entry = first + lane < count ? first + lane : count - 1;
+        const vector3 *p = get_position(vertices, indices, entry);
+        lanes[0][lane] = p->x;
+        lanes[1][lane] = p->y;
+        lanes[2][lane] = p->z;
+    }
+}
+#endif
+
+void transform_position_batch(matrix4x4 matrix,
+                              const struct standard_vertex_attribute *vertices,
+                              const uint32_t *indices, uint32_t count,
+                              struct position_batch *batch) {
+    if (count == 0) {
+        return;
+    }
+    float *coordinates[4] = {batch->x, batch->y, batch->z, batch->w};
+#if defined(HAS_SSE)
+    __m128 elements[4][4];
+    for (int r = 0; r < 4; r++) {
+        for (int c = 0; c < 4; c++) {
+            elements[r][c] = _mm_set1_ps(matrix.elements[r][c]);
+        }
+    }
+    for (uint32_t i = 0; i < count; i += 4) {
+        float lanes[3][4];
+        gather_positions(vertices, indices, count, i, lanes);
+        __m128 x = _mm_loadu_ps(lanes[0]);
+        __m128 y = _mm_loadu_ps(lanes[1]);
+        __m128 z = _mm_loadu_ps(lanes[2]);
+        for (int r = 0; r < 4; r++) {
+            __m128 result = _mm_mul_ps(elements[r][0], x);
+            result = _mm_add_ps(result, _mm_mul_ps(elements[r][1], y));
+            result = _mm_add_ps(result, _mm_mul_ps(elements[r][2], z));
+            result = _mm_add_ps(result, elements[r][3]);
+            _mm_storeu_ps(coordinates[r] + i, result);
+        }
+    }
+#elif defined(HAS_NEON)
+    float32x4_t elements[4][4];
+    for (int r = 0; r < 4; r++) {
+        for (int c = 0; c < 4; c++) {
+            elements[r][c] = vdupq_n_f32(matrix.elements[r][c]);
+        }
+    }
+    for (uint32_t i = 0; i < count; i += 4) {
+        float lanes[3][4];
+        gather_positions(vertices, indices, count, i, lanes);
+        float32x4_t x = vld1q_f32(lanes[0]);
+        float32x4_t y = vld1q_f32(lanes[1]);
+        float32x4_t z = vld1q_f32(lanes[2]);
+        for (int r = 0; r < 4; r++) {
+            // Separate multiplications and additions, unlike vfmaq_f32(), to
+            // round like the SSE path.
+            float32x4_t result = vmulq_f32(elements[r][0], x);
+            result = vaddq_f32(result, vmulq_f32(elements[r][1], y));
+            result = vaddq_f32(result, vmulq_f32(elements[r][2], z));
+            result = vaddq_f32(result, elements[r][3]);
+            vst1q_f32(coordinates[r] + i, result);
+        }
+    }
+#else
+    for (uint32_t i = 0; i < count; i++) {
+        const vector3 *p = get_position(vertices, indices, i);
+        for (int r = 0; r < 4; r++) {
+            coordinates[r][i] = matrix.elements[r][0] * p->x +
+                                matrix.elements[r][1] * p->y +
+                                matrix.elements[r][2] * p->z +
+                                matrix.elements[r][3];
+        }
+    }
+#endif
+}
+
+void project_position_batch(const struct position_batch *batch,
+                            uint32_t count, int32_t *codes, float *x,
+                            float *y) {
+    // The batch arrays have room for whole registers, but codes, x and y
+    // only for count entries, so the last partial register is left to the
+    // scalar loop.
+    uint32_t i = 0;
+#if defined(HAS_SSE)
+    __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4) {
+        __m128 bx = _mm_loadu_ps(batch->x + i);
+        __m128 by = _mm_loadu_ps(batch->y + i);
+        __m128 bz = _mm_loadu_ps(batch->z + i);
+        __m128 bw = _mm_loadu_ps(batch->w + i);
+        __m128 negative_w = _mm_xor_ps(bw, sign);
+        __m128 masks[7] = {
+            _mm_cmplt_ps(bx, negative_w), _mm_cmpgt_ps(bx, bw),
+            _mm_cmplt_ps(by, negative_w), _mm_cmpgt_ps(by, bw),
+            _mm_cmplt_ps(bz, negative_w), _mm_cmpgt_ps(bz, bw),
+            _mm_cmpngt_ps(bw, zero)};
+        __m128i code = _mm_setzero_si128();
+        for (int b = 0; b < 7; b++) {
+            code = _mm_or_si128(code, _mm_and_si128(_mm_castps_si128(masks[b]),
+                                                    _mm_set1_epi32(1 << b)));
+        }
+        _mm_storeu_si128((__m128i *)(codes + i), code);
+        _mm_storeu_ps(x + i, _mm_div_ps(bx, bw));
+        _mm_storeu_ps(y + i, _mm_div_ps(by, bw));
+    }
+#elif defined(HAS_NEON)
+    float32x4_t zero = vdupq_n_f32(0.0f);
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t bx = vld1q_f32(batch->x + i);
+        float32x4_t by = vld1q_f32(batch->y + i);
+        float32x4_t bz = vld1q_f32(batch->z + i);
+        float32x4_t bw = vld1q_f32(batch->w + i);
+        float32x4_t negative_w = vnegq_f32(bw);
+        uint32x4_t masks[7] = {
+            vcltq_f32(bx, negative_w), vcgtq_f32(bx, bw),
+            vcltq_f32(by, negative_w), vcgtq_f32(by, bw),
+            vcltq_f32(bz, negative_w), vcgtq_f32(bz, bw),
+            vmvnq_u32(vcgtq_f32(bw, zero))};
+        uint32x4_t code = vdupq_n_u32(0);
+        for (int b = 0; b < 7; b++) {
+            code = vorrq_u32(code, vandq_u32(masks[b], vdupq_n_u32(1u << b)));
+        }
+        vst1q_s32(codes + i, vreinterpretq_s32_u32(code));
+        vst1q_f32(x + i, vdivq_f32(bx, bw));
+        vst1q_f32(y + i, vdivq_f32(by, bw));
+    }
+#endif
+    for (; i < count; i++) {
+        float w = batch->w[i];
+        int32_t code = 0;
+        code |= batch->x[i] < -w ? 1 : 0;
+        code |= batch->x[i] > w ? 2 : 0;
+        code |= batch->y[i] < -w ? 4 : 0;
+        code |= batch->y[i] > w ? 8 : 0;
+        code |= batch->z[i] < -w ? 16 : 0;
+        code |= batch->z[i] > w ? 32 : 0;
+        code |= w > 0.0f ? 0 : OUTCODE_BEHIND_CAMERA;
+        codes[i] = code;
+        x[i] = batch->x[i] / w;
+        y[i] = batch->y[i] / w;
+    }
+}
@@ -0,0 +1,49 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#ifndef POSITION_BATCH_H_
+#define POSITION_BATCH_H_
+
+#include <stdint.h>
+
+#include "math/matrix.h"
+#include "shaders/standard.h"
+
+// Most positions transformed at once. A multiple of the SIMD width.
+#define POSITION_BATCH_SIZE 64
+
+// Clip-space positions of a batch of vertices, one array per coordinate, so
+// that SSE or NEON transform the same coordinate of four positions with one
+// instruction.
+struct position_batch {
+    float x[POSITION_BATCH_SIZE];
+    float y[POSITION_BATCH_SIZE];
+    float z[POSITION_BATCH_SIZE];
+    float w[POSITION_BATCH_SIZE];
+};
+
+// Transforms the positions of count vertices, at most POSITION_BATCH_SIZE, by
+// the matrix into the batch: entry i is the position of vertices[indices[i]],
+// or of vertices[i] if indices is NULL. The results of the SIMD and the scalar
+// path may differ in the last bit where the compiler fuses the scalar
+// multiplications and additions.
+void transform_position_batch(matrix4x4 matrix,
+                              const struct standard_vertex_attribute *vertices,
+                              const uint32_t *indices, uint32_t count,
+                              struct position_batch *batch);
+
+// Added to the outcode of a position that is not in front of the camera.
+#define OUTCODE_BEHIND_CAMERA 64
+
+// Projects the first count positions of the batch. Stores the outcode of each
+// in codes, with the bits 1, 2, 4, 8, 16 and 32 set if x < -w, x > w, y < -w,
+// y > w, z < -w and z > w, and OUTCODE_BEHIND_CAMERA if w is not positive.
+// Stores its normalized device coordinates in x and y, which are only
+// meaningful in front of the camera.
+void project_position_batch(const struct position_batch *batch,
+                            uint32_t count, int32_t *codes, float *x,
+                            float *y);
+
+#endif  // POSITION_BATCH_H_
@@ -0,0 +1,167 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "profiler.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "graphics/rasterizer.h"
+#include "math/vector.h"
+
+// Longest row of the profile, including the terminating null character.
+#define ROW_SIZE 512
+
+static const char *stage_names[PROFILE_STAGE_COUNT] = {
+    "frame_ms",   "shadow_ms",        "cull_ms",   "clear_ms", "vertex_ms",
+    "binning_ms", "depth_prepass_ms", "raster_ms", "save_ms"};
+
+static const char *counter_names[PROFILE_COUNTER_COUNT] = {
+    "triangles",          "culled_triangles", "culled_meshlets",
+    "unbinned_triangles", "tile_triangles",   "occluded_triangles",
+    "shaded_vertices",    "shaded_fragments"};
+
+// The profile file, or -1 if no rows are written.
+static int profile_file = -1;
+static bool profiling;
+// Stage times are only added by the thread that drives the frame.
+static double stage_seconds[PROFILE_STAGE_COUNT];
+static atomic_uint_fast64_t counters[PROFILE_COUNTER_COUNT];
+static fragment_shader counted_shader;
+
+bool open_profile(void) {
+    const char *path = getenv("ANIM_PROFILE");
+    if (path == NULL || path[0] == '\0') {
+        return true;
+    }
+    // Every row is appended with a single write(), so the rows of concurrent
+    // workers do not interleave.
+    int file = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (file < 0) {
+        printf("Cannot open %s.\n", path);
+        return false;
+    }
+    struct stat status;
+    if (fstat(file, &status) == 0 && status.st_size == 0) {
+        char header[ROW_SIZE];
+        int length = snprintf(header, ROW_SIZE, "clip,frame,pid");
+        for (int i = 0; i < PROFILE_STAGE_COUNT; i++) {
+            length += snprintf(header + length, ROW_SIZE - (size_t)length,
+                               ",%s", stage_names[i]);
+        }
+        for (int i = 0; i < PROFILE_COUNTER_COUNT; i++) {
+            length += snprintf(header + length, ROW_SIZE - (size_t)length,
+                               ",%s", counter_names[i]);
+        }
+        header[length++] = '\n';
+        if (write(file, header, (size_t)length) != length) {
+            printf("Cannot write %s.\n", path);
+            close(file);
+            return false;
+        }
+    }
+    profile_file = file;
+    set_profiling(true);
+    return true;
+}
+
+void close_profile(void) {
+    if (profile_file >= 0) {
+        close(profile_file);
+        profile_file = -1;
+        set_profiling(false);
+    }
+}
+
+void set_profiling(bool enabled) {
+    profiling = enabled;
+    for (int i = 0; i < PROFILE_STAGE_COUNT; i++) {
+        stage_seconds[i] = 0.0;
+    }
+    for (int i = 0; i < PROFILE_COUNTER_COUNT; i++) {
+        atomic_store(&counters[i], 0);
+    }
+}
+
+bool is_profiling(void) { return profiling; }
+
+double get_profile_time(void) {
+    if (!profiling) {
+        return 0.0;
+    }
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+void add_profile_time(enum profile_stage stage, double start) {
+    if (profiling) {
+        stage_seconds[stage] += get_profile_time() - start;
+    }
+}
+
+void add_profile_count(enum profile_counter counter, uint64_t count) {
+    if (profiling) {
+        atomic_fetch_add_explicit(&counters[counter], count,
+                                  memory_order_relaxed);
+    }
+}
+
+static vector4 counting_fragment_shader(struct shader_context *input,
+                                        const void *uniform) {
+    atomic_fetch_add_explicit(&counters[PROFILE_COUNTER_SHADED_FRAGMENTS], 1,
+                              memory_order_relaxed);
+    return counted_shader(input, uniform);
+}
+
+fragment_shader count_fragments(fragment_shader shader) {
+    if (!profiling) {
+        return shader;
+    }
+    counted_shader = shader;
+    return counting_fragment_shader;
+}
+
+uint64_t take_profile_count(enum profile_counter counter) {
+    return atomic_exchange(&counters[counter], 0);
+}
+
+void write_frame_profile(const char *clip, int frame) {
+    if (profile_file < 0) {
+        return;
+    }
+    char row[ROW_SIZE];
+    int length =
+        snprintf(row, ROW_SIZE, "%s,%d,%ld", clip, frame, (long)getpid());
+    for (int i = 0; i < PROFILE_STAGE_COUNT && length < ROW_SIZE; i++) {
+        length += snprintf(row + length, ROW_SIZE - (size_t)length, ",%.3f",
+                           stage_seconds[i] * 1000.0);
+        stage_seconds[i] = 0.0;
+    }
+    for (int i = 0; i < PROFILE_COUNTER_COUNT && length < ROW_SIZE; i++) {
+        uint64_t count = atomic_exchange(&counters[i], 0);
+        length += snprintf(row + length, ROW_SIZE - (size_t)length, ",%llu",
+                           (unsigned long long)count);
+    }
+    if (length >= ROW_SIZE - 1) {
+        printf("Cannot write the profile of frame %d.\n", frame);
+        return;
+    }
+    row[length++] = '\n';
+    if (write(profile_file, row, (size_t)length) != length) {
+        printf("Cannot write the profile of frame %d.\n", frame);
+    }
+}
@@ -0,0 +1,91 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "graphics/rasterizer.h"
+
+// Where the time of a frame goes. Stages run one after another, so their times
+// add up to at most the time of the whole frame.
+enum profile_stage {
+    PROFILE_STAGE_FRAME,
+    PROFILE_STAGE_SHADOW,
+    PROFILE_STAGE_CULL,
+    PROFILE_STAGE_CLEAR,
+    PROFILE_STAGE_VERTEX,
+    PROFILE_STAGE_BINNING,
+    PROFILE_STAGE_DEPTH_PREPASS,
+    // Rasterization and fragment shading, which the rasterizer interleaves.
+    PROFILE_STAGE_RASTER,
+    // The time save_frame() blocks, not the background encoding.
+    PROFILE_STAGE_SAVE,
+    PROFILE_STAGE_COUNT
+};
+
+// Counts of the draws of render_mesh(). The shadow pass is only timed.
+enum profile_counter {
+    PROFILE_COUNTER_TRIANGLES,
+    // Triangles removed by cull_mesh(), which are never handed to the
+    // rasterizer.
+    PROFILE_COUNTER_CULLED_TRIANGLES,
+    // Meshlets cull_mesh() removed as a whole, whose triangles count towards
+    // the culled triangles.
+    PROFILE_COUNTER_CULLED_MESHLETS,
+    // Triangles that survived cull_mesh() but overlap no tile, so they are
+    // only counted when tiles are rendered.
+    PROFILE_COUNTER_UNBINNED_TRIANGLES,
+    // Triangles drawn into a tile, counted once per tile.
+    PROFILE_COUNTER_TILE_TRIANGLES,
+    // Triangles skipped in a tile because the depth pre-pass hides them.
+    PROFILE_COUNTER_OCCLUDED_TRIANGLES,
+    PROFILE_COUNTER_SHADED_VERTICES,
+    PROFILE_COUNTER_SHADED_FRAGMENTS,
+    PROFILE_COUNTER_COUNT
+};
+
+// Opens the CSV file named by the ANIM_PROFILE environment variable, if it is
+// set, and writes its header if it is empty. Must be called before workers
+// are started, which then append one row per frame to the same file. Returns
+// false if the file cannot be opened.
+bool open_profile(void);
+
+void close_profile(void);
+
+// Starts or stops measuring without a profile file, for callers that read
+// the counters themselves, and resets all measurements.
+void set_profiling(bool enabled);
+
+// Whether measurements are taken, which open_profile() starts if it opened a
+// file. Nothing is measured otherwise.
+bool is_profiling(void);
+
+// Returns a timestamp to pass to add_profile_time(), or 0 when not profiling.
+double get_profile_time(void);
+
+// Adds the time since start, a timestamp from get_profile_time(), to the stage
+// of the current frame.
+void add_profile_time(enum profile_stage stage, double start);
+
+// Adds to a counter of the current frame. Safe to call from several threads.
+void add_profile_count(enum profile_counter counter, uint64_t count);
+
+// Returns a fragment shader that counts its calls into
+// PROFILE_COUNTER_SHADED_FRAGMENTS and then calls shader, or shader itself
+// when not profiling. Only one shader can be counted at a time.
+fragment_shader count_fragments(fragment_shader shader);
+
+// Returns a counter of the current frame and resets it.
+uint64_t take_profile_count(enum profile_counter counter);
+
+// Appends the measurements of the current frame to the profile as a row for
+// the frame of the clip, then starts measuring the next frame. Does nothing
+// without a profile file.
+void write_frame_profile(const char *clip, int frame);
+
+#endif  // PROFILER_H_
@@ -0,0 +1,295 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#include "render_target.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graphics/framebuffer.h"
+#include "graphics/rasterizer.h"
+#include "graphics/texture.h"
+#include "math/matrix.h"
+#include "math/vector.h"
+#include "shaders/shadow_casting.h"
+#include "shaders/standard.h"
+
+#include "baked_mesh.h"
+#include "frame_arena.h"
+#include "frame_sink.h"
+#include "frame_writer.h"
+#include "profiler.h"
+#include "task_scheduler.h"
+#include "tile_renderer.h"
+
+bool get_depth_prepass(void) {
+    const char *value = getenv("ANIM_DEPTH_PREPASS");
+    return value != NULL && strcmp(value, "") != 0 && strcmp(value, "0") != 0;
+}
+
+float get_max_lod_error(void) {
+    const char *value = getenv("ANIM_LOD_ERROR");
+    if (value == NULL || value[0] == '\0') {
+        return DEFAULT_MAX_LOD_ERROR;
+    }
+    return (float)atof(value);
+}
+
+struct render_target *create_render_target(
+    const struct render_target_settings *settings) {
+    struct render_target *target = calloc(1, sizeof(struct render_target));
+    if (target == NULL) {
+        return NULL;
+    }
+    uint32_t width = settings->width;
+    uint32_t height = settings->height;
+    target->width = width;
+    target->height = height;
+    target->depth_prepass = settings->depth_prepass;
+    target->max_lod_error = settings->max_lod_error;
+    target->frame_sink = settings->frame_sink;
+    target->tile_thread_count = settings->tile_thread_count;
+    target->output_buffer_count = settings->output_buffer_count;
+    target->arena = create_frame_arena();
+    target->framebuffer = create_framebuffer();
+    target->color_buffer =
+        create_texture(TEXTURE_FORMAT_SRGB8_A8, width, height);
+    target->depth_buffer =
+        create_texture(TEXTURE_FORMAT_DEPTH_FLOAT, width, height);
+    if (target->arena == NULL || target->framebuffer == NULL ||
+        target->color_buffer == NULL || target->depth_buffer == NULL) {
+        destroy_render_target(target);
+        return NULL;
+    }
+    attach_texture_to_framebuffer(target->framebuffer, COLOR_ATTACHMENT,
+                                  target->color_buffer);
+    attach_texture_to_framebuffer(target->framebuffer, DEPTH_ATTACHMENT,
+                                  target->depth_buffer);
+    if (settings->shadow_map_width > 0 && settings->shadow_map_height > 0) {
+        target->shadow_framebuffer = create_framebuffer();
+        target->shadow_map =
+            create_texture(TEXTURE_FORMAT_DEPTH_FLOAT,
+                           settings->shadow_map_width,
+                           settings->shadow_map_height);
+        if (target->shadow_framebuffer == NULL || target->shadow_map == NULL) {
+            destroy_render_target(target);
+            return NULL;
+        }
+        attach_texture_to_framebuffer(target->shadow_framebuffer,
+                                      DEPTH_ATTACHMENT, target->shadow_map);
+    }
+    // The tile threads also save the frames. Without tiles, one more thread
+    // saves them while the calling thread renders.
+    int thread_count = settings->tile_thread_count;
+    if (settings->output_buffer_count > 1 && thread_count < 2) {
+        thread_count = 2;
+    }
+    if (thread_count > 1) {
+        target->scheduler = create_task_scheduler(thread_count);
+        if (target->scheduler == NULL) {
+            destroy_render_target(target);
+            return NULL;
+        }
+    }
+    if (settings->tile_thread_count > 1) {
+        target->tile_renderer =
+            create_tile_renderer(width, height, target->scheduler);
+        if (target->tile_renderer == NULL) {
+            destroy_render_target(target);
+            return NULL;
+        }
+    }
+    if (settings->output_buffer_count > 1) {
+        target->frame_writer =
+            create_frame_writer(width, height, settings->output_buffer_count,
+                                target->scheduler);
+        if (target->frame_writer == NULL) {
+            destroy_render_target(target);
+            return NULL;
+        }
+    }
+    return target;
+}
+
+bool reuse_render_target(struct render_target *target,
+                         const struct render_target_settings *settings) {
+    uint32_t shadow_map_width = 0;
+    uint32_t shadow_map_height = 0;
+    if (settings->shadow_map_width > 0 && settings->shadow_map_height > 0) {
+        shadow_map_width = settings->shadow_map_width;
+        shadow_map_height = settings->shadow_map_height;
+    }
+    uint32_t target_shadow_map_width = 0;
+    uint32_t target_shadow_map_height = 0;
+    if (target->shadow_map != NULL) {
+        target_shadow_map_width = target->shadow_map->width;
+        target_shadow_map_height = target->shadow_map->height;
+    }
+    if (target->width != settings->width ||
+        target->height != settings->height ||
+        target_shadow_map_width != shadow_map_width ||
+        target_shadow_map_height != shadow_map_height ||
+        target->tile_thread_count != settings->tile_thread_count ||
+        target->output_buffer_count != settings->output_buffer_count) {
+        return false;
+    }
+    target->depth_prepass = settings->depth_prepass;
+    target->max_lod_error = settings->max_lod_error;
+    target->frame_sink = settings->frame_sink;
+    return true;
+}
+
+void destroy_render_target(struct render_target *target) {
+    if (target == NULL) {
+        return;
+    }
+    // Finish saving the queued frames first.
+    destroy_frame_writer(target->frame_writer);
+    destroy_texture(target->color_buffer);
+    destroy_texture(target->depth_buffer);
+    destroy_texture(target->shadow_map);
+    destroy_frame_arena(target->arena);
+    destroy_tile_renderer(target->tile_renderer);
+    destroy_task_scheduler(target->scheduler);
+    if (target->framebuffer != NULL) {
+        destroy_framebuffer(target->framebuffer);
+    }
+    if (target->shadow_framebuffer != NULL) {
+        destroy_framebuffer(target->shadow_framebuffer);
+    }
+    free(target);
+}
+
+static bool draw_mesh(struct render_target *target, vertex_shader vertex_shader,
+                      batch_vertex_shader batch_vertex_shader,
+                      fragment_shader fragment_shader, const void *uniform,
+                      const struct baked_mesh *mesh,
+                      const struct draw_culling *culling,
+                      struct vertex_cache *cache) {
+    fragment_shader = count_fragments(fragment_shader);
+    add_profile_count(PROFILE_COUNTER_TRIANGLES, mesh->triangle_count);
+    uint32_t shaded_vertex_count = mesh->vertex_count;
+    struct baked_mesh view;
+    if (culling != NULL) {
+        double start = get_profile_time();
+        if (!cull_mesh(mesh, culling, cache, &view)) {
+            return false;
+        }
+        add_profile_time(PROFILE_STAGE_CULL, start);
+        add_profile_count(PROFILE_COUNTER_CULLED_TRIANGLES,
+                          mesh->triangle_count - view.triangle_count);
+        add_profile_count(PROFILE_COUNTER_CULLED_MESHLETS,
+                          cache->culled_meshlet_count);
+        shaded_vertex_count = cache->used_vertex_count;
+        mesh = &view;
+    }
+    add_profile_count(PROFILE_COUNTER_SHADED_VERTICES, shaded_vertex_count);
+    if (target->tile_renderer != NULL) {
+        return draw_indexed_tiled(target->tile_renderer, target->color_buffer,
+                                  target->depth_buffer, vertex_shader,
+                                  batch_vertex_shader, fragment_shader,
+                                  uniform, mesh, cache, target->depth_prepass);
+    }
+    double start = get_profile_time();
+    set_viewport(0, 0, target->width, target->height);
+    clear_framebuffer(target->framebuffer);
+    add_profile_time(PROFILE_STAGE_CLEAR, start);
+    if (!reserve_vertex_cache(cache, mesh->vertex_count)) {
+        return false;
+    }
+    start = get_profile_time();
+    shade_vertex_range(vertex_shader, batch_vertex_shader, uniform, mesh,
+                       cache, 0, mesh->vertex_count);
+    add_profile_time(PROFILE_STAGE_VERTEX, start);
+    if (target->depth_prepass) {
+        start = get_profile_time();
+        draw_shaded_depth(target->framebuffer, mesh, cache);
+        add_profile_time(PROFILE_STAGE_DEPTH_PREPASS, start);
+    }
+    start = get_profile_time();
+    draw_shaded(target->framebuffer, fragment_shader, uniform, mesh,
+                cache);
+    add_profile_time(PROFILE_STAGE_RASTER, start);
+    return true;
+}
+
+bool render_mesh(struct render_target *target, vertex_shader vertex_shader,
+                 batch_vertex_shader batch_vertex_shader,
+                 fragment_shader fragment_shader, const void *uniform,
+                 const struct baked_mesh *mesh,
+                 const struct draw_culling *culling) {
+    struct arena_mark mark = get_arena_mark(target->arena);
+    struct vertex_cache cache = {0};
+    cache.arena = target->arena;
+    bool result = draw_mesh(target, vertex_shader, batch_vertex_shader,
+                            fragment_shader, uniform, mesh, culling, &cache);
+    release_arena(target->arena, mark);
+    return result;
+}
+
+bool save_frame(struct render_target *target, int frame) {
+    double start = get_profile_time();
+    bool result = true;
+    if (target->frame_writer != NULL) {
+        queue_frame(target->frame_writer, target->frame_sink,
+                    target->framebuffer, &target->color_buffer, frame);
+    } else {
+        result = write_frame(target->frame_sink, target->color_buffer, frame);
+    }
+    add_profile_time(PROFILE_STAGE_SAVE, start);
+    return result;
+}
+
+// Feeds the position of a baked vertex to the shadow casting shader.
+static vector4 shadow_vertex_shader(struct shader_context *output,
+                                    const void *uniform, const void *vertex) {
+    const struct standard_vertex_attribute *attribute = vertex;
+    struct shadow_casting_vertex_attribute shadow_attribute;
+    shadow_attribute.position = attribute->position;
+    return shadow_casting_vertex_shader(output, uniform, &shadow_attribute);
+}
+
+bool render_shadow_map(struct render_target *target, matrix4x4 local2clip,
+                       const struct baked_mesh *mesh,
+                       const struct draw_culling *culling) {
+    const struct baked_mesh *shadow_mesh = mesh;
+    if (shadow_mesh == target->shadow_mesh &&
+        memcmp(&local2clip, &target->shadow_local2clip,
+               sizeof(matrix4x4)) == 0) {
+        return true;
+    }
+    target->shadow_mesh = NULL;
+    double start = get_profile_time();
+    struct arena_mark mark = get_arena_mark(target->arena);
+    struct vertex_cache cache = {0};
+    cache.arena = target->arena;
+    struct baked_mesh view;
+    if (culling != NULL) {
+        if (!cull_mesh(mesh, culling, &cache, &view)) {
+            release_arena(target->arena, mark);
+            return false;
+        }
+        mesh = &view;
+    }
+    const struct texture *shadow_map = target->shadow_map;
+    set_viewport(0, 0, shadow_map->width, shadow_map->height);
+    clear_framebuffer(target->shadow_framebuffer);
+    struct shadow_casting_uniform uniform;
+    uniform.local2clip = local2clip;
+    bool result = draw_indexed(target->shadow_framebuffer,
+                               shadow_vertex_shader,
+                               shadow_casting_fragment_shader, &uniform, mesh,
+                               &cache);
+    release_arena(target->arena, mark);
+    if (result) {
+        target->shadow_mesh = shadow_mesh;
+        target->shadow_local2clip = local2clip;
+    }
+    add_profile_time(PROFILE_STAGE_SHADOW, start);
+    return result;
+}
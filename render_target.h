@@ -0,0 +1,131 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#ifndef RENDER_TARGET_H_
+#define RENDER_TARGET_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "graphics/framebuffer.h"
+#include "graphics/rasterizer.h"
+#include "graphics/texture.h"
+#include "math/matrix.h"
+
+#include "baked_mesh.h"
+#include "frame_arena.h"
+#include "frame_sink.h"
+#include "frame_writer.h"
+#include "task_scheduler.h"
+#include "tile_renderer.h"
+
+#define DEFAULT_MAX_LOD_ERROR 1.0f
+
+struct render_target_settings {
+    uint32_t width, height;
+    // Zero if the target renders no shadows.
+    uint32_t shadow_map_width, shadow_map_height;
+    // Every frame is split into tiles rendered by this many threads if it is
+    // greater than 1.
+    int tile_thread_count;
+    // Draws the depth of every mesh before shading it, so that hidden
+    // fragments are not shaded.
+    bool depth_prepass;
+    // Meshes are drawn at the coarsest level of detail that moves no vertex
+    // by more than this many pixels. Zero draws them in full.
+    float max_lod_error;
+    // Color buffers to rotate between rendering and saving. Frames are saved
+    // on a background thread if this is greater than 1.
+    int output_buffer_count;
+    // Where save_frame() writes to.
+    const struct frame_sink *frame_sink;
+};
+
+// Returns whether a depth pre-pass is requested through the
+// ANIM_DEPTH_PREPASS environment variable.
+bool get_depth_prepass(void);
+
+// Returns the largest error of a level of detail in pixels, from the
+// ANIM_LOD_ERROR environment variable, or DEFAULT_MAX_LOD_ERROR if it is not
+// set.
+float get_max_lod_error(void);
+
+// Everything a worker writes to while rendering one frame. Each worker owns
+// its own render target so that frames can be rendered concurrently.
+struct render_target {
+    uint32_t width, height;
+    struct framebuffer *framebuffer;
+    struct texture *color_buffer;
+    struct texture *depth_buffer;
+    // NULL if the target renders no shadows.
+    struct framebuffer *shadow_framebuffer;
+    struct texture *shadow_map;
+    // What the shadow map holds, so that drawing it again the same way can be
+    // skipped. NULL if it holds nothing.
+    const struct baked_mesh *shadow_mesh;
+    matrix4x4 shadow_local2clip;
+    // The memory of the draws of the current frame. Each draw releases what
+    // it allocated when it returns.
+    struct frame_arena *arena;
+    // The threads the tile renderer and the frame writer share. NULL if
+    // neither needs more than the calling thread.
+    struct task_scheduler *scheduler;
+    // NULL if frames are rendered on a single thread.
+    struct tile_renderer *tile_renderer;
+    bool depth_prepass;
+    float max_lod_error;
+    const struct frame_sink *frame_sink;
+    int tile_thread_count;
+    int output_buffer_count;
+    // NULL if frames are saved synchronously.
+    struct frame_writer *frame_writer;
+};
+
+// Creates a framebuffer with an sRGB color buffer and a float depth buffer of
+// the given size attached, and a depth-only shadow framebuffer if shadows are
+// enabled. Returns NULL if any of the resources cannot be created.
+struct render_target *create_render_target(
+    const struct render_target_settings *settings);
+
+void destroy_render_target(struct render_target *target);
+
+// Prepares the target to render with the settings, keeping its buffers, if it
+// was created with the same sizes, tile threads and output buffers. Only the
+// depth pre-pass, the level of detail error and the frame sink can change;
+// frames already saved keep going to the previous sink. Returns false if the
+// target cannot be reused.
+bool reuse_render_target(struct render_target *target,
+                         const struct render_target_settings *settings);
+
+// Clears the target to the clear color and draws the mesh over the whole
+// target with the given shaders, after a depth pre-pass if the target was
+// created with one. The vertices are shaded with batch_vertex_shader instead
+// of vertex_shader if it is not NULL. Triangles are culled with cull_mesh()
+// first unless culling is NULL. This changes the viewport and the bound
+// shaders. Returns false if the memory needed for drawing cannot be allocated.
+bool render_mesh(struct render_target *target, vertex_shader vertex_shader,
+                 batch_vertex_shader batch_vertex_shader,
+                 fragment_shader fragment_shader, const void *uniform,
+                 const struct baked_mesh *mesh,
+                 const struct draw_culling *culling);
+
+// Writes the color buffer to the frame sink as the given frame. With a frame
+// writer the frame is written in the background and the target gets a new
+// color buffer, so the color buffer must not be kept across this call. Returns
+// false if the frame cannot be written synchronously.
+bool save_frame(struct render_target *target, int frame);
+
+// Clears the shadow map and draws the depth of the mesh into it, as seen
+// through local2clip, culled like render_mesh() does unless culling is NULL.
+// Nothing is drawn if the shadow map already holds the same mesh through the
+// same transform, which culling does not change. The target must have been
+// created with shadows enabled. This changes the viewport and the bound
+// shaders. Returns false if the memory needed for drawing cannot be
+// allocated.
+bool render_shadow_map(struct render_target *target, matrix4x4 local2clip,
+                       const struct baked_mesh *mesh,
+                       const struct draw_culling *culling);
+
+#endif  // RENDER_TARGET_H_
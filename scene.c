@@ -0,0 +1,510 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#include "scene.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graphics/texture.h"
+#include "math/math_utility.h"
+#include "math/vector.h"
+
+#include "asset_cache.h"
+#include "baked_mesh.h"
+#include "mip_chain.h"
+
+// Longest line of a scene file, including the newline.
+#define LINE_SIZE 512
+#define MAX_TOKEN_COUNT 8
+
+enum field_type {
+    FIELD_STRING,
+    // A string passed to snprintf() with the frame number.
+    FIELD_NAME_FORMAT,
+    // Two uint32_t, the width and the height.
+    FIELD_SIZE,
+    FIELD_INT,
+    FIELD_FLOAT,
+    FIELD_VECTOR3,
+    FIELD_MESH,
+    FIELD_SRGB_MAP,
+    FIELD_LINEAR_MAP,
+    // "none", "frustum" or "back_faces".
+    FIELD_CULLING,
+    FIELD_FLOAT_TRACK,
+    FIELD_VECTOR3_TRACK
+};
+
+struct field {
+    const char *name;
+    enum field_type type;
+    size_t offset;
+    // Loading fails if a required field is not given.
+    bool required;
+};
+
+static const struct field fields[] = {
+    {"output_directory", FIELD_STRING, offsetof(struct scene, output_directory),
+     true},
+    {"output_name", FIELD_NAME_FORMAT,
+     offsetof(struct scene, output_name_format), true},
+    {"image_size", FIELD_SIZE, offsetof(struct scene, image_width), true},
+    {"shadow_map_size", FIELD_SIZE, offsetof(struct scene, shadow_map_width),
+     false},
+    {"fps", FIELD_INT, offsetof(struct scene, fps), false},
+    {"duration", FIELD_FLOAT, offsetof(struct scene, duration), true},
+    {"mesh", FIELD_MESH, offsetof(struct scene, mesh), true},
+    {"base_color_map", FIELD_SRGB_MAP, offsetof(struct scene, base_color_map),
+     false},
+    {"normal_map", FIELD_LINEAR_MAP, offsetof(struct scene, normal_map), false},
+    {"metallic_map", FIELD_LINEAR_MAP, offsetof(struct scene, metallic_map),
+     false},
+    {"roughness_map", FIELD_LINEAR_MAP, offsetof(struct scene, roughness_map),
+     false},
+    {"camera_target", FIELD_VECTOR3, offsetof(struct scene, camera_target),
+     false},
+    {"fov", FIELD_FLOAT, offsetof(struct scene, fov), false},
+    {"near", FIELD_FLOAT, offsetof(struct scene, near), false},
+    {"far", FIELD_FLOAT, offsetof(struct scene, far), false},
+    {"illuminance", FIELD_VECTOR3, offsetof(struct scene, illuminance), false},
+    {"ambient_luminance", FIELD_VECTOR3,
+     offsetof(struct scene, ambient_luminance), false},
+    {"base_color", FIELD_VECTOR3, offsetof(struct scene, base_color), false},
+    {"metallic", FIELD_FLOAT, offsetof(struct scene, metallic), false},
+    {"roughness", FIELD_FLOAT, offsetof(struct scene, roughness), false},
+    {"reflectance", FIELD_FLOAT, offsetof(struct scene, reflectance), false},
+    {"culling", FIELD_CULLING, offsetof(struct scene, culling), false},
+    {"camera_position", FIELD_VECTOR3_TRACK,
+     offsetof(struct scene, camera_position), true},
+    {"light_direction", FIELD_VECTOR3_TRACK,
+     offsetof(struct scene, light_direction), false},
+    {"rotation_y", FIELD_FLOAT_TRACK, offsetof(struct scene, rotation_y),
+     false},
+};
+
+#define FIELD_COUNT (sizeof(fields) / sizeof(fields[0]))
+
+static const struct field *find_field(const char *name) {
+    for (size_t i = 0; i < FIELD_COUNT; i++) {
+        if (strcmp(fields[i].name, name) == 0) {
+            return &fields[i];
+        }
+    }
+    return NULL;
+}
+
+static bool parse_float(const char *token, float *result) {
+    char *end;
+    float value = strtof(token, &end);
+    if (end == token || *end != '\0' || !isfinite(value)) {
+        return false;
+    }
+    *result = value;
+    return true;
+}
+
+static bool parse_positive_int(const char *token, long max, long *result) {
+    char *end;
+    long value = strtol(token, &end, 10);
+    if (end == token || *end != '\0' || value <= 0 || value > max) {
+        return false;
+    }
+    *result = value;
+    return true;
+}
+
+static bool parse_floats(char **tokens, int count, float *result) {
+    for (int i = 0; i < count; i++) {
+        if (!parse_float(tokens[i], &result[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Accepts formats with exactly one integer conversion, so that passing the
+// format to snprintf() with the frame number is safe.
+static bool is_name_format_valid(const char *format) {
+    int conversion_count = 0;
+    for (const char *c = format; *c != '\0'; c++) {
+        if (*c != '%') {
+            continue;
+        }
+        c++;
+        if (*c == '%') {
+            continue;
+        }
+        while (*c != '\0' && strchr("-+ #0", *c) != NULL) {
+            c++;
+        }
+        while (isdigit((unsigned char)*c)) {
+            c++;
+        }
+        if (*c == '.') {
+            c++;
+            while (isdigit((unsigned char)*c)) {
+                c++;
+            }
+        }
+        if (*c != 'd' && *c != 'i') {
+            return false;
+        }
+        conversion_count++;
+    }
+    return conversion_count == 1;
+}
+
+static bool parse_easing(const char *token, enum easing *result) {
+    if (strcmp(token, "linear") == 0) {
+        *result = EASING_LINEAR;
+    } else if (strcmp(token, "ease_in_out_cubic") == 0) {
+        *result = EASING_EASE_IN_OUT_CUBIC;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static int get_track_component_count(enum field_type type) {
+    return type == FIELD_FLOAT_TRACK ? 1 : 3;
+}
+
+// Parses "key <property> <time> <value>... [easing]" and appends the keyframe
+// to the track. Keyframes must be given in increasing time order.
+static bool parse_keyframe(struct scene *scene, char **tokens,
+                           int token_count) {
+    if (token_count < 2) {
+        return false;
+    }
+    const struct field *field = find_field(tokens[1]);
+    if (field == NULL || (field->type != FIELD_FLOAT_TRACK &&
+                          field->type != FIELD_VECTOR3_TRACK)) {
+        return false;
+    }
+    int component_count = get_track_component_count(field->type);
+    if (token_count != 3 + component_count &&
+        token_count != 4 + component_count) {
+        return false;
+    }
+    struct track *track = (struct track *)((char *)scene + field->offset);
+    if (track->keyframe_count == MAX_KEYFRAME_COUNT) {
+        return false;
+    }
+    struct keyframe keyframe;
+    keyframe.value = VECTOR3_ZERO;
+    keyframe.easing = EASING_LINEAR;
+    if (!parse_float(tokens[2], &keyframe.time) ||
+        !parse_floats(tokens + 3, component_count, keyframe.value.elements)) {
+        return false;
+    }
+    if (token_count == 4 + component_count &&
+        !parse_easing(tokens[3 + component_count], &keyframe.easing)) {
+        return false;
+    }
+    if (keyframe.time < 0.0f || keyframe.time > 1.0f) {
+        return false;
+    }
+    if (track->keyframe_count > 0 &&
+        keyframe.time <= track->keyframes[track->keyframe_count - 1].time) {
+        return false;
+    }
+    track->keyframes[track->keyframe_count++] = keyframe;
+    return true;
+}
+
+// Parses "<field> <value>...". A plain value of an animated property makes it
+// constant, replacing any keyframes given before.
+static bool parse_field(struct scene *scene, struct asset_cache *cache,
+                        const struct field *field, char **tokens,
+                        int token_count, const char *path, int line) {
+    char *pointer = (char *)scene + field->offset;
+    int value_count = token_count - 1;
+    char **values = tokens + 1;
+    long number;
+    switch (field->type) {
+        case FIELD_STRING:
+        case FIELD_NAME_FORMAT:
+            if (value_count != 1 || strlen(values[0]) >= SCENE_STRING_SIZE) {
+                return false;
+            }
+            if (field->type == FIELD_NAME_FORMAT &&
+                !is_name_format_valid(values[0])) {
+                return false;
+            }
+            strcpy(pointer, values[0]);
+            return true;
+        case FIELD_SIZE: {
+            long height;
+            if (value_count != 2 ||
+                !parse_positive_int(values[0], 16384, &number) ||
+                !parse_positive_int(values[1], 16384, &height)) {
+                return false;
+            }
+            uint32_t *size = (uint32_t *)pointer;
+            size[0] = (uint32_t)number;
+            size[1] = (uint32_t)height;
+            return true;
+        }
+        case FIELD_INT:
+            if (value_count != 1 ||
+                !parse_positive_int(values[0], 1000, &number)) {
+                return false;
+            }
+            *(int *)pointer = (int)number;
+            return true;
+        case FIELD_FLOAT:
+            return value_count == 1 && parse_float(values[0], (float *)pointer);
+        case FIELD_VECTOR3:
+            return value_count == 3 &&
+                   parse_floats(values, 3, ((vector3 *)pointer)->elements);
+        case FIELD_MESH: {
+            if (value_count != 1) {
+                return false;
+            }
+            const struct baked_mesh *mesh = get_cached_mesh(cache, values[0]);
+            if (mesh == NULL) {
+                printf("Cannot load %s, used at %s:%d.\n", values[0], path,
+                       line);
+                return false;
+            }
+            *(const struct baked_mesh **)pointer = mesh;
+            return true;
+        }
+        case FIELD_SRGB_MAP:
+        case FIELD_LINEAR_MAP: {
+            if (value_count != 1) {
+                return false;
+            }
+            const struct mip_chain *image = get_cached_image(
+                cache, values[0], field->type == FIELD_SRGB_MAP);
+            if (image == NULL) {
+                printf("Cannot load %s, used at %s:%d.\n", values[0], path,
+                       line);
+                return false;
+            }
+            *(const struct mip_chain **)pointer = image;
+            return true;
+        }
+        case FIELD_CULLING: {
+            enum culling *culling = (enum culling *)pointer;
+            if (value_count != 1) {
+                return false;
+            } else if (strcmp(values[0], "none") == 0) {
+                *culling = CULLING_NONE;
+            } else if (strcmp(values[0], "frustum") == 0) {
+                *culling = CULLING_FRUSTUM;
+            } else if (strcmp(values[0], "back_faces") == 0) {
+                *culling = CULLING_BACK_FACES;
+            } else {
+                return false;
+            }
+            return true;
+        }
+        case FIELD_FLOAT_TRACK:
+        case FIELD_VECTOR3_TRACK: {
+            int component_count = get_track_component_count(field->type);
+            struct track *track = (struct track *)pointer;
+            struct keyframe keyframe;
+            keyframe.time = 0.0f;
+            keyframe.value = VECTOR3_ZERO;
+            keyframe.easing = EASING_LINEAR;
+            if (value_count != component_count ||
+                !parse_floats(values, component_count,
+                              keyframe.value.elements)) {
+                return false;
+            }
+            track->keyframe_count = 1;
+            track->keyframes[0] = keyframe;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void set_constant_track(struct track *track, vector3 value) {
+    track->keyframe_count = 1;
+    track->keyframes[0].time = 0.0f;
+    track->keyframes[0].value = value;
+    track->keyframes[0].easing = EASING_LINEAR;
+}
+
+static void set_defaults(struct scene *scene) {
+    scene->fps = 30;
+    scene->fov = PI / 5.0f;
+    scene->near = 0.1f;
+    scene->far = 5.0f;
+    scene->base_color = VECTOR3_ONE;
+    scene->roughness = 1.0f;
+    scene->reflectance = 0.5f;  // Common dielectric surfaces F0.
+    scene->culling = CULLING_BACK_FACES;
+    set_constant_track(&scene->light_direction, (vector3){{0.0f, 1.0f, 0.0f}});
+    set_constant_track(&scene->rotation_y, VECTOR3_ZERO);
+}
+
+// Points the maps the scene file does not give to 1x1 images that are
+// equivalent to not using textures.
+static bool set_default_maps(struct scene *scene, struct asset_cache *cache) {
+    const uint8_t white[4] = {255, 255, 255, 255};
+    const uint8_t flat_normal[4] = {128, 128, 255, 255};
+    if (scene->base_color_map == NULL) {
+        scene->base_color_map =
+            get_constant_image(cache, TEXTURE_FORMAT_SRGB8_A8, white);
+    }
+    if (scene->normal_map == NULL) {
+        scene->normal_map =
+            get_constant_image(cache, TEXTURE_FORMAT_RGBA8, flat_normal);
+    }
+    if (scene->metallic_map == NULL) {
+        scene->metallic_map =
+            get_constant_image(cache, TEXTURE_FORMAT_R8, white);
+    }
+    if (scene->roughness_map == NULL) {
+        scene->roughness_map =
+            get_constant_image(cache, TEXTURE_FORMAT_R8, white);
+    }
+    return scene->base_color_map != NULL && scene->normal_map != NULL &&
+           scene->metallic_map != NULL && scene->roughness_map != NULL;
+}
+
+// Splits the line at whitespace, ignoring everything after a '#'. Returns the
+// number of tokens, or -1 if there are too many.
+static int split_line(char *line, char **tokens) {
+    char *comment = strchr(line, '#');
+    if (comment != NULL) {
+        *comment = '\0';
+    }
+    int token_count = 0;
+    for (char *token = strtok(line, " \t\r\n"); token != NULL;
+         token = strtok(NULL, " \t\r\n")) {
+        if (token_count == MAX_TOKEN_COUNT) {
+            return -1;
+        }
+        tokens[token_count++] = token;
+    }
+    return token_count;
+}
+
+struct scene *load_scene(const char *path, struct asset_cache *cache) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        printf("Cannot open %s.\n", path);
+        return NULL;
+    }
+    struct scene *scene = calloc(1, sizeof(struct scene));
+    if (scene == NULL) {
+        fclose(file);
+        return NULL;
+    }
+    set_defaults(scene);
+
+    bool given[FIELD_COUNT] = {false};
+    char line[LINE_SIZE];
+    bool succeeded = true;
+    for (int line_number = 1; fgets(line, LINE_SIZE, file) != NULL;
+         line_number++) {
+        char *tokens[MAX_TOKEN_COUNT];
+        int token_count = split_line(line, tokens);
+        if (token_count == 0) {
+            continue;
+        }
+        bool parsed = false;
+        bool is_keyframe = strcmp(tokens[0], "key") == 0;
+        const struct field *field = NULL;
+        if (!is_keyframe) {
+            field = find_field(tokens[0]);
+        } else if (token_count > 1) {
+            field = find_field(tokens[1]);
+        }
+        if (field != NULL && is_keyframe) {
+            // The first keyframe replaces the default value.
+            if (!given[field - fields]) {
+                ((struct track *)((char *)scene + field->offset))
+                    ->keyframe_count = 0;
+            }
+            parsed = parse_keyframe(scene, tokens, token_count);
+        } else if (field != NULL) {
+            parsed = parse_field(scene, cache, field, tokens, token_count,
+                                 path, line_number);
+        }
+        if (parsed) {
+            given[field - fields] = true;
+        }
+        if (!parsed) {
+            printf("Cannot parse %s:%d.\n", path, line_number);
+            succeeded = false;
+            break;
+        }
+    }
+    fclose(file);
+
+    for (size_t i = 0; succeeded && i < FIELD_COUNT; i++) {
+        if (fields[i].required && !given[i]) {
+            printf("Cannot load %s without %s.\n", path, fields[i].name);
+            succeeded = false;
+        }
+    }
+    if (succeeded && get_scene_frame_count(scene) < 1) {
+        printf("Cannot load %s without frames.\n", path);
+        succeeded = false;
+    }
+    if (succeeded && !set_default_maps(scene, cache)) {
+        printf("Cannot create default textures.\n");
+        succeeded = false;
+    }
+    if (!succeeded) {
+        free(scene);
+        return NULL;
+    }
+    return scene;
+}
+
+void destroy_scene(struct scene *scene) { free(scene); }
+
+int get_scene_frame_count(const struct scene *scene) {
+    return (int)(scene->duration * scene->fps);
+}
+
+static float ease_in_out_cubic(float t) {
+    return t < 0.5f ? 4.0f * t * t * t : 1.0f - powf(-2 * t + 2, 3.0f) / 2.0f;
+}
+
+static vector3 evaluate_track(const struct track *track, float t) {
+    const struct keyframe *keyframes = track->keyframes;
+    if (t <= keyframes[0].time) {
+        return keyframes[0].value;
+    }
+    for (int i = 1; i < track->keyframe_count; i++) {
+        if (t < keyframes[i].time) {
+            const struct keyframe *from = &keyframes[i - 1];
+            const struct keyframe *to = &keyframes[i];
+            float u = (t - from->time) / (to->time - from->time);
+            if (to->easing == EASING_EASE_IN_OUT_CUBIC) {
+                u = ease_in_out_cubic(u);
+            }
+            vector3 value;
+            for (int c = 0; c < 3; c++) {
+                value.elements[c] = float_lerp(from->value.elements[c],
+                                               to->value.elements[c], u);
+            }
+            return value;
+        }
+    }
+    return keyframes[track->keyframe_count - 1].value;
+}
+
+void get_scene_frame(const struct scene *scene, int frame,
+                     struct scene_frame *result) {
+    float t = (float)frame / get_scene_frame_count(scene);
+    result->camera_position = evaluate_track(&scene->camera_position, t);
+    result->light_direction = evaluate_track(&scene->light_direction, t);
+    result->rotation_y = evaluate_track(&scene->rotation_y, t).x;
+}
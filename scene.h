@@ -0,0 +1,89 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#ifndef SCENE_H_
+#define SCENE_H_
+
+#include <stdint.h>
+
+#include "math/vector.h"
+
+#include "asset_cache.h"
+#include "baked_mesh.h"
+#include "mip_chain.h"
+
+#define SCENE_STRING_SIZE 128
+#define MAX_KEYFRAME_COUNT 16
+
+enum easing { EASING_LINEAR, EASING_EASE_IN_OUT_CUBIC };
+
+// Which triangles are culled before the vertices of a draw are shaded.
+enum culling { CULLING_NONE, CULLING_FRUSTUM, CULLING_BACK_FACES };
+
+struct keyframe {
+    // In [0, 1], the fraction of the animation at which the value is reached.
+    float time;
+    vector3 value;
+    // Applies to the segment that ends at this keyframe.
+    enum easing easing;
+};
+
+// An animated property. It keeps the first value before the first keyframe
+// and the last value after the last one.
+struct track {
+    int keyframe_count;
+    struct keyframe keyframes[MAX_KEYFRAME_COUNT];
+};
+
+// A model, the camera and the lights of one animation, loaded from a scene
+// file. See scenes/ for the format.
+struct scene {
+    char output_directory[SCENE_STRING_SIZE];
+    char output_name_format[SCENE_STRING_SIZE];
+    uint32_t image_width, image_height;
+    // Zero if the scene renders no shadows.
+    uint32_t shadow_map_width, shadow_map_height;
+    int fps;
+    float duration;
+    // The assets are owned by the asset cache the scene was loaded with.
+    const struct baked_mesh *mesh;
+    const struct mip_chain *base_color_map;
+    const struct mip_chain *normal_map;
+    const struct mip_chain *metallic_map;
+    const struct mip_chain *roughness_map;
+    vector3 camera_target;
+    float fov, near, far;
+    vector3 illuminance;
+    vector3 ambient_luminance;
+    vector3 base_color;
+    float metallic, roughness, reflectance;
+    // CULLING_BACK_FACES also culls what is outside the view frustum.
+    enum culling culling;
+    struct track camera_position;
+    struct track light_direction;
+    // The rotation around the y axis is the x component of the values.
+    struct track rotation_y;
+};
+
+// The animated properties of a scene at one frame.
+struct scene_frame {
+    vector3 camera_position;
+    vector3 light_direction;
+    float rotation_y;
+};
+
+// Loads a scene file and the assets it uses through the cache. Maps that are
+// not given default to 1x1 images that are equivalent to not using them.
+// Returns NULL if the file cannot be parsed or an asset cannot be loaded.
+struct scene *load_scene(const char *path, struct asset_cache *cache);
+
+void destroy_scene(struct scene *scene);
+
+int get_scene_frame_count(const struct scene *scene);
+
+void get_scene_frame(const struct scene *scene, int frame,
+                     struct scene_frame *result);
+
+#endif  // SCENE_H_
@@ -0,0 +1,259 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#include "scene_renderer.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "graphics/rasterizer.h"
+#include "graphics/texture.h"
+#include "math/matrix.h"
+#include "math/vector.h"
+#include "shaders/standard.h"
+
+#include "baked_mesh.h"
+#include "frame_arena.h"
+#include "render_target.h"
+#include "scene.h"
+#include "standard_variants.h"
+
+// Fits an orthographic light projection around the bounding sphere of the
+// mesh.
+static matrix4x4 get_light_world2clip(vector3 light_direction,
+                                      matrix4x4 local2world,
+                                      const struct baked_mesh *mesh) {
+    vector4 center = {{mesh->center.x, mesh->center.y, mesh->center.z, 1.0f}};
+    vector3 world_center = VECTOR3_ZERO;
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 4; c++) {
+            world_center.elements[r] +=
+                local2world.elements[r][c] * center.elements[c];
+        }
+    }
+    float radius = mesh->radius;
+    vector3 direction = vector3_normalize(light_direction);
+    vector3 light_position = vector3_add(
+        world_center, vector3_multiply_scalar(direction, 2.0f * radius));
+    vector3 up = (vector3){{0.0f, 1.0f, 0.0f}};
+    if (fabsf(direction.y) > 0.99f) {
+        up = (vector3){{0.0f, 0.0f, 1.0f}};
+    }
+    matrix4x4 world2view = matrix4x4_look_at(light_position, world_center, up);
+    matrix4x4 view2clip =
+        matrix4x4_orthographic(radius, radius, radius, 3.0f * radius);
+    return matrix4x4_multiply(view2clip, world2view);
+}
+
+// Returns the culling of a draw through local2clip, or NULL if the scene culls
+// nothing.
+static const struct draw_culling *get_culling(const struct scene *scene,
+                                              matrix4x4 local2clip,
+                                              struct draw_culling *culling) {
+    if (scene->culling == CULLING_NONE) {
+        return NULL;
+    }
+    culling->local2clip = local2clip;
+    culling->back_faces = scene->culling == CULLING_BACK_FACES;
+    return culling;
+}
+
+// The matrices derived from the animated values of the last frame. Frames next
+// to each other often share some of the values, such as a fixed camera or
+// light, so only the matrices whose inputs changed are recomputed. The inputs
+// are compared by value, so the caches stay correct across scenes. Workers are
+// processes that render one frame at a time, so each keeps its own.
+struct camera_cache {
+    bool valid;
+    vector3 position, target;
+    float fov, aspect, near, far;
+    matrix4x4 world2clip;
+};
+
+struct model_cache {
+    bool valid;
+    float rotation_y;
+    matrix4x4 local2world;
+    matrix3x3 local2world_direction;
+};
+
+struct light_cache {
+    bool valid;
+    // Whether the entry holds the light transform of a scene with shadows.
+    bool shadows;
+    vector3 direction;
+    float rotation_y;
+    vector3 center;
+    float radius;
+    vector3 normalized_direction;
+    matrix4x4 local2light;
+    matrix4x4 world2light;
+};
+
+static struct camera_cache camera_cache;
+static struct model_cache model_cache;
+static struct light_cache light_cache;
+
+static bool is_same_vector3(vector3 a, vector3 b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+static const struct camera_cache *get_camera(const struct scene *scene,
+                                             vector3 position) {
+    struct camera_cache *cache = &camera_cache;
+    float aspect = (float)scene->image_width / scene->image_height;
+    if (cache->valid && is_same_vector3(cache->position, position) &&
+        is_same_vector3(cache->target, scene->camera_target) &&
+        cache->fov == scene->fov && cache->aspect == aspect &&
+        cache->near == scene->near && cache->far == scene->far) {
+        return cache;
+    }
+    matrix4x4 world2view = matrix4x4_look_at(position, scene->camera_target,
+                                             (vector3){{0.0f, 1.0f, 0.0f}});
+    matrix4x4 view2clip =
+        matrix4x4_perspective(scene->fov, aspect, scene->near, scene->far);
+    cache->world2clip = matrix4x4_multiply(view2clip, world2view);
+    cache->position = position;
+    cache->target = scene->camera_target;
+    cache->fov = scene->fov;
+    cache->aspect = aspect;
+    cache->near = scene->near;
+    cache->far = scene->far;
+    cache->valid = true;
+    return cache;
+}
+
+static const struct model_cache *get_model(float rotation_y) {
+    struct model_cache *cache = &model_cache;
+    if (cache->valid && cache->rotation_y == rotation_y) {
+        return cache;
+    }
+    cache->local2world = matrix4x4_rotate_y(rotation_y);
+    cache->local2world_direction = matrix4x4_to_3x3(cache->local2world);
+    cache->rotation_y = rotation_y;
+    cache->valid = true;
+    return cache;
+}
+
+// Also computes the light transform of the shadow pass if the scene has
+// shadows.
+static const struct light_cache *get_light(const struct scene *scene,
+                                           vector3 direction,
+                                           const struct model_cache *model) {
+    struct light_cache *cache = &light_cache;
+    const struct baked_mesh *mesh = scene->mesh;
+    bool shadows = scene->shadow_map_width > 0;
+    if (cache->valid && cache->shadows == shadows &&
+        is_same_vector3(cache->direction, direction)) {
+        if (!shadows) {
+            return cache;
+        }
+        if (cache->rotation_y == model->rotation_y &&
+            is_same_vector3(cache->center, mesh->center) &&
+            cache->radius == mesh->radius) {
+            return cache;
+        }
+    }
+    matrix4x4 light_world2clip = {{{0.0f}}};
+    if (shadows) {
+        light_world2clip =
+            get_light_world2clip(direction, model->local2world, mesh);
+    }
+    cache->local2light =
+        matrix4x4_multiply(light_world2clip, model->local2world);
+    // Remap each component of position from [-1, 1] to [0, 1].
+    matrix4x4 scale_bias = {{{0.5f, 0.0f, 0.0f, 0.5f},
+                             {0.0f, 0.5f, 0.0f, 0.5f},
+                             {0.0f, 0.0f, 0.5f, 0.5f},
+                             {0.0f, 0.0f, 0.0f, 1.0f}}};
+    cache->world2light = matrix4x4_multiply(scale_bias, light_world2clip);
+    cache->normalized_direction = vector3_normalize(direction);
+    cache->direction = direction;
+    cache->shadows = shadows;
+    cache->rotation_y = model->rotation_y;
+    cache->center = mesh->center;
+    cache->radius = mesh->radius;
+    cache->valid = true;
+    return cache;
+}
+
+static void render_model(struct render_target *target,
+                         const struct scene_frame *state,
+                         const struct scene_context *context) {
+    const struct scene *scene = context->scene;
+    const struct model_cache *model = get_model(state->rotation_y);
+    const struct light_cache *light =
+        get_light(scene, state->light_direction, model);
+    const struct camera_cache *camera =
+        get_camera(scene, state->camera_position);
+    matrix4x4 local2clip =
+        matrix4x4_multiply(camera->world2clip, model->local2world);
+    // The shadow pass draws the same level as the camera, so that every
+    // surface is compared with its own depth in the shadow map.
+    const struct baked_mesh *mesh =
+        select_mesh_lod(scene->mesh, local2clip, target->width,
+                        target->height, target->max_lod_error);
+    struct texture *shadow_map = context->unlit_shadow_map;
+    if (scene->shadow_map_width > 0) {
+        struct draw_culling culling;
+        if (!render_shadow_map(
+                target, light->local2light, mesh,
+                get_culling(scene, light->local2light, &culling))) {
+            printf("Cannot allocate memory for drawing.\n");
+        }
+        shadow_map = target->shadow_map;
+    }
+
+    set_clear_color(0.0f, 0.0f, 0.0f, 0.0f);
+
+    struct standard_uniform uniform;
+    uniform.local2world = model->local2world;
+    uniform.world2clip = camera->world2clip;
+    uniform.local2world_direction = model->local2world_direction;
+    // There is no non-uniform scaling so the normal transformation matrix is
+    // the direction transformation matrix.
+    uniform.local2world_normal = uniform.local2world_direction;
+    uniform.camera_position = state->camera_position;
+    uniform.light_direction = light->normalized_direction;
+    uniform.illuminance = scene->illuminance;
+    uniform.world2light = light->world2light;
+    uniform.shadow_map = shadow_map;
+    uniform.ambient_luminance = scene->ambient_luminance;
+    uniform.normal_map = scene->normal_map->levels[0];
+    uniform.base_color = scene->base_color;
+    uniform.base_color_map = scene->base_color_map->levels[0];
+    uniform.metallic = scene->metallic;
+    uniform.metallic_map = scene->metallic_map->levels[0];
+    uniform.roughness = scene->roughness;
+    uniform.roughness_map = scene->roughness_map->levels[0];
+    uniform.reflectance = scene->reflectance;
+
+    struct mip_selection mips;
+    mips.base_color_mips = scene->base_color_map;
+    mips.metallic_mips = scene->metallic_map;
+    mips.texcoord_density = scene->mesh->texcoord_density;
+    mips.target_height = target->height;
+    struct ambient_uniform ambient_uniform;
+    struct shader_binding shaders =
+        select_standard_shaders(&uniform, &mips, &ambient_uniform);
+    struct draw_culling culling;
+    const struct draw_culling *mesh_culling =
+        get_culling(scene, local2clip, &culling);
+    if (!render_mesh(target, shaders.vertex_shader,
+                     shaders.batch_vertex_shader, shaders.fragment_shader,
+                     shaders.uniform, mesh, mesh_culling)) {
+        printf("Cannot allocate memory for drawing.\n");
+    }
+    // Merge the memory the draws needed into one block for the next frame.
+    reset_frame_arena(target->arena);
+}
+
+void render_scene_frame(struct render_target *target,
+                        const struct scene_context *context, int frame) {
+    struct scene_frame state;
+    get_scene_frame(context->scene, frame, &state);
+    render_model(target, &state, context);
+}
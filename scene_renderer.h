@@ -0,0 +1,28 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#ifndef SCENE_RENDERER_H_
+#define SCENE_RENDERER_H_
+
+#include "graphics/texture.h"
+
+#include "render_target.h"
+#include "scene.h"
+
+// What every worker reads while it renders the frames of one scene.
+struct scene_context {
+    const struct scene *scene;
+    // The fully lit 1x1 shadow map that every fragment of a scene without
+    // shadows sees.
+    struct texture *unlit_shadow_map;
+};
+
+// Renders the frame of the scene into the target, with a shadow pass first if
+// the scene has shadows. The frame is not saved. This changes the viewport,
+// the clear color and the bound shaders.
+void render_scene_frame(struct render_target *target,
+                        const struct scene_context *context, int frame);
+
+#endif  // SCENE_RENDERER_H_
@@ -0,0 +1,245 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#include "standard_variants.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "graphics/rasterizer.h"
+#include "graphics/texture.h"
+#include "math/matrix.h"
+#include "math/vector.h"
+#include "shaders/standard.h"
+
+#include "baked_mesh.h"
+#include "mip_chain.h"
+#include "position_batch.h"
+
+// Index of the texcoord among the vector2 varyings and of the LOD among the
+// float varyings in the shader context.
+#define TEXCOORD 0
+#define LOD 0
+
+// Returns the level of the chain whose texels are closest to a pixel in size.
+static inline const struct texture *select_level(
+    const struct texture *map, const struct mip_chain *mips, float lod) {
+    if (mips == NULL) {
+        return map;
+    }
+    // Round to the nearest level.
+    float level = lod + 0.5f;
+    if (!(level >= 1.0f)) {
+        return map;
+    }
+    uint32_t index = (uint32_t)fminf(level, (float)(mips->level_count - 1));
+    return mips->levels[index];
+}
+
+#define DEFINE_AMBIENT_VERTEX_SHADER(name, output_texcoord)                   \
+    static vector4 name(struct shader_context *output, const void *uniform,   \
+                        const void *vertex) {                                 \
+        const struct ambient_uniform *unif = uniform;                         \
+        const struct standard_vertex_attribute *attribute = vertex;           \
+        vector4 position = {{attribute->position.x, attribute->position.y,    \
+                             attribute->position.z, 1.0f}};                   \
+        vector4 clip_position;                                                \
+        for (int r = 0; r < 4; r++) {                                         \
+            clip_position.elements[r] = 0.0f;                                 \
+            for (int c = 0; c < 4; c++) {                                     \
+                clip_position.elements[r] +=                                  \
+                    unif->local2clip.elements[r][c] * position.elements[c];   \
+            }                                                                 \
+        }                                                                     \
+        if (output_texcoord) {                                                \
+            *shader_context_vector2(output, TEXCOORD) = attribute->texcoord;  \
+            *shader_context_float(output, LOD) =                              \
+                log2f(fmaxf(clip_position.w, 1e-6f)) + unif->lod_bias;        \
+        }                                                                     \
+        return clip_position;                                                 \
+    }
+
+// The same as DEFINE_AMBIENT_VERTEX_SHADER, but shades the used vertices of a
+// range a batch at a time, so that their positions are transformed together.
+#define DEFINE_AMBIENT_BATCH_VERTEX_SHADER(name, output_texcoord)             \
+    static void name(const void *uniform, const struct baked_mesh *mesh,      \
+                     struct vertex_cache *cache, uint32_t first,              \
+                     uint32_t last) {                                         \
+        const struct ambient_uniform *unif = uniform;                         \
+        uint32_t indices[POSITION_BATCH_SIZE];                                \
+        struct position_batch batch;                                          \
+        uint32_t i = first;                                                   \
+        while (i < last) {                                                    \
+            uint32_t count = 0;                                               \
+            for (; i < last && count < POSITION_BATCH_SIZE; i++) {            \
+                if (mesh->used_vertices == NULL || mesh->used_vertices[i]) {  \
+                    indices[count++] = i;                                     \
+                }                                                             \
+            }                                                                 \
+            transform_position_batch(unif->local2clip, mesh->vertices,        \
+                                     indices, count, &batch);                 \
+            for (uint32_t j = 0; j < count; j++) {                            \
+                struct shaded_vertex *shaded = cache->vertices + indices[j];  \
+                memset(&shaded->context, 0, sizeof(struct shader_context));   \
+                shaded->position = (vector4){                                 \
+                    {batch.x[j], batch.y[j], batch.z[j], batch.w[j]}};        \
+                if (output_texcoord) {                                        \
+                    *shader_context_vector2(&shaded->context, TEXCOORD) =     \
+                        mesh->vertices[indices[j]].texcoord;                  \
+                    *shader_context_float(&shaded->context, LOD) =            \
+                        log2f(fmaxf(batch.w[j], 1e-6f)) + unif->lod_bias;     \
+                }                                                             \
+            }                                                                 \
+        }                                                                     \
+    }
+
+// sample_base_color and sample_metallic are constants, so the branches and
+// the texture fetches of unused maps are removed at compile time.
+#define DEFINE_AMBIENT_FRAGMENT_SHADER(name, sample_base_color,               \
+                                       sample_metallic)                       \
+    static vector4 name(struct shader_context *input, const void *uniform) {  \
+        const struct ambient_uniform *unif = uniform;                         \
+        vector3 color = unif->color;                                          \
+        if (sample_base_color || sample_metallic) {                           \
+            vector2 texcoord = *shader_context_vector2(input, TEXCOORD);      \
+            float lod = *shader_context_float(input, LOD);                    \
+            if (sample_base_color) {                                          \
+                vector4 base_color = texture_sample(                          \
+                    select_level(unif->base_color_map, unif->base_color_mips, \
+                                 lod + unif->base_color_lod_offset),          \
+                    texcoord);                                                \
+                color.x *= base_color.x;                                      \
+                color.y *= base_color.y;                                      \
+                color.z *= base_color.z;                                      \
+            }                                                                 \
+            if (sample_metallic) {                                            \
+                float metallic =                                              \
+                    unif->metallic *                                          \
+                    texture_sample(                                           \
+                        select_level(unif->metallic_map, unif->metallic_mips, \
+                                     lod + unif->metallic_lod_offset),        \
+                        texcoord)                                             \
+                        .x;                                                   \
+                color = vector3_multiply_scalar(color, 1.0f - metallic);      \
+            }                                                                 \
+        }                                                                     \
+        return (vector4){{color.x, color.y, color.z, 1.0f}};                  \
+    }
+
+DEFINE_AMBIENT_VERTEX_SHADER(ambient_vertex_shader, true)
+DEFINE_AMBIENT_VERTEX_SHADER(ambient_untextured_vertex_shader, false)
+DEFINE_AMBIENT_BATCH_VERTEX_SHADER(ambient_batch_vertex_shader, true)
+DEFINE_AMBIENT_BATCH_VERTEX_SHADER(ambient_untextured_batch_vertex_shader,
+                                   false)
+
+DEFINE_AMBIENT_FRAGMENT_SHADER(ambient_fragment_shader, true, true)
+DEFINE_AMBIENT_FRAGMENT_SHADER(ambient_base_color_fragment_shader, true, false)
+DEFINE_AMBIENT_FRAGMENT_SHADER(ambient_metallic_fragment_shader, false, true)
+DEFINE_AMBIENT_FRAGMENT_SHADER(ambient_untextured_fragment_shader, false,
+                               false)
+
+static bool is_constant_map(const struct texture *map) {
+    return map == NULL || (map->width == 1 && map->height == 1);
+}
+
+static vector4 sample_constant_map(const struct texture *map) {
+    if (map == NULL) {
+        return (vector4){{1.0f, 1.0f, 1.0f, 1.0f}};
+    }
+    return texture_sample(map, (vector2){{0.5f, 0.5f}});
+}
+
+// Finds how much log2 of the clip-space w has to be offset to get the mip level
+// of a map one texel wide: a pixel at w covers 2 * w / (scale * height) units
+// of the mesh, where scale is how much the projection stretches local y.
+static float get_lod_bias(matrix4x4 local2clip,
+                          const struct mip_selection *mips) {
+    float scale = 0.0f;
+    for (int c = 0; c < 3; c++) {
+        scale += local2clip.elements[1][c] * local2clip.elements[1][c];
+    }
+    scale = sqrtf(scale);
+    float pixel_size = 2.0f / (scale * (float)mips->target_height);
+    return log2f(fmaxf(mips->texcoord_density * pixel_size, 1e-30f));
+}
+
+struct shader_binding select_standard_shaders(
+    const struct standard_uniform *uniform, const struct mip_selection *mips,
+    struct ambient_uniform *ambient_uniform) {
+    struct shader_binding binding;
+    vector3 illuminance = uniform->illuminance;
+    if (illuminance.x != 0.0f || illuminance.y != 0.0f ||
+        illuminance.z != 0.0f) {
+        binding.vertex_shader = standard_vertex_shader;
+        binding.batch_vertex_shader = NULL;
+        binding.fragment_shader = standard_fragment_shader;
+        binding.uniform = uniform;
+        return binding;
+    }
+
+    bool sample_base_color = !is_constant_map(uniform->base_color_map);
+    bool sample_metallic = !is_constant_map(uniform->metallic_map);
+    vector3 color = uniform->base_color;
+    if (!sample_base_color) {
+        vector4 base_color = sample_constant_map(uniform->base_color_map);
+        color.x *= base_color.x;
+        color.y *= base_color.y;
+        color.z *= base_color.z;
+    }
+    color.x *= uniform->ambient_luminance.x;
+    color.y *= uniform->ambient_luminance.y;
+    color.z *= uniform->ambient_luminance.z;
+    if (!sample_metallic) {
+        float metallic = uniform->metallic *
+                         sample_constant_map(uniform->metallic_map).x;
+        color = vector3_multiply_scalar(color, 1.0f - metallic);
+    }
+    ambient_uniform->local2clip =
+        matrix4x4_multiply(uniform->world2clip, uniform->local2world);
+    ambient_uniform->color = color;
+    ambient_uniform->base_color_map = uniform->base_color_map;
+    ambient_uniform->metallic = uniform->metallic;
+    ambient_uniform->metallic_map = uniform->metallic_map;
+    ambient_uniform->base_color_mips = NULL;
+    ambient_uniform->metallic_mips = NULL;
+    ambient_uniform->lod_bias = 0.0f;
+    ambient_uniform->base_color_lod_offset = 0.0f;
+    ambient_uniform->metallic_lod_offset = 0.0f;
+    if (mips != NULL) {
+        ambient_uniform->base_color_mips = mips->base_color_mips;
+        ambient_uniform->metallic_mips = mips->metallic_mips;
+        ambient_uniform->lod_bias =
+            get_lod_bias(ambient_uniform->local2clip, mips);
+        if (sample_base_color) {
+            ambient_uniform->base_color_lod_offset =
+                log2f((float)uniform->base_color_map->width);
+        }
+        if (sample_metallic) {
+            ambient_uniform->metallic_lod_offset =
+                log2f((float)uniform->metallic_map->width);
+        }
+    }
+
+    if (sample_base_color && sample_metallic) {
+        binding.fragment_shader = ambient_fragment_shader;
+    } else if (sample_base_color) {
+        binding.fragment_shader = ambient_base_color_fragment_shader;
+    } else if (sample_metallic) {
+        binding.fragment_shader = ambient_metallic_fragment_shader;
+    } else {
+        binding.fragment_shader = ambient_untextured_fragment_shader;
+    }
+    binding.vertex_shader = sample_base_color || sample_metallic
+                                ? ambient_vertex_shader
+                                : ambient_untextured_vertex_shader;
+    binding.batch_vertex_shader = sample_base_color || sample_metallic
+                                      ? ambient_batch_vertex_shader
+                                      : ambient_untextured_batch_vertex_shader;
+    binding.uniform = ambient_uniform;
+    return binding;
+}
@@ -0,0 +1,75 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#ifndef STANDARD_VARIANTS_H_
+#define STANDARD_VARIANTS_H_
+
+#include "graphics/rasterizer.h"
+#include "graphics/texture.h"
+#include "math/matrix.h"
+#include "math/vector.h"
+#include "shaders/standard.h"
+
+#include "baked_mesh.h"
+#include "mip_chain.h"
+
+// Uniform of the ambient-only variants of the standard shader.
+struct ambient_uniform {
+    matrix4x4 local2clip;
+    // Added to log2 of the clip-space w of a vertex to get the mip level of a
+    // map one texel wide there.
+    float lod_bias;
+    // Everything that does not depend on the texcoord: base color times
+    // ambient luminance, and times (1 - metallic) if metallic is constant.
+    vector3 color;
+    const struct texture *base_color_map;
+    // NULL if base_color_map is sampled directly.
+    const struct mip_chain *base_color_mips;
+    // log2 of the width of the map, added to the LOD of a one texel map.
+    float base_color_lod_offset;
+    float metallic;
+    const struct texture *metallic_map;
+    // NULL if metallic_map is sampled directly.
+    const struct mip_chain *metallic_mips;
+    float metallic_lod_offset;
+};
+
+// What the ambient variants need to pick the mip levels of the maps. The
+// level is chosen per vertex from its distance to the camera and the average
+// texcoord density of the mesh, and interpolated across the triangle.
+struct mip_selection {
+    // The chains whose level 0 is the base color or metallic map of the
+    // uniform, or NULL to always sample the map itself.
+    const struct mip_chain *base_color_mips;
+    const struct mip_chain *metallic_mips;
+    // The texcoord_density of the baked mesh to draw.
+    float texcoord_density;
+    // Height in pixels of the target the mesh is drawn to.
+    uint32_t target_height;
+};
+
+// The shaders and uniform to draw with.
+struct shader_binding {
+    vertex_shader vertex_shader;
+    // Shades the vertices in batches instead of vertex_shader, or NULL.
+    batch_vertex_shader batch_vertex_shader;
+    fragment_shader fragment_shader;
+    const void *uniform;
+};
+
+// Picks the cheapest shaders that render the uniform like the standard shaders.
+// If direct light is off, only the ambient term of the standard shader is left,
+// so the binding uses a variant specialized at compile time for whether the
+// base color and metallic maps need to be sampled, which shades its vertices in
+// batches with transform_position_batch(). A map that is NULL or 1x1 is folded
+// into the constant factors, and sampled maps use the mip chains of mips if it
+// is not NULL. The variant's uniform is written to ambient_uniform, which must
+// outlive the draw. Otherwise the standard shaders and uniform are returned,
+// which always sample level 0 of the maps.
+struct shader_binding select_standard_shaders(
+    const struct standard_uniform *uniform, const struct mip_selection *mips,
+    struct ambient_uniform *ambient_uniform);
+
+#endif  // STANDARD_VARIANTS_H_
@@ -0,0 +1,300 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#include "task_scheduler.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct task {
+    task_function function;
+    void *argument;
+    uint32_t index;
+    struct task_group *group;
+};
+
+// A thread and the ring of its tasks. Its own thread pops tasks from the back,
+// the others steal them from the front.
+struct task_thread {
+    struct task_scheduler *scheduler;
+    int index;
+    pthread_t handle;
+    pthread_mutex_t mutex;
+    struct task *tasks;
+    uint32_t capacity;
+    uint32_t head, count;
+};
+
+struct task_scheduler {
+    int thread_count;
+    struct task_thread *threads;
+    // The threads besides thread 0 that are running.
+    int started_count;
+    // Only for sleeping: threads without tasks wait for queued to become
+    // non-zero on changed, thread 0 waits for its group on finished.
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    pthread_cond_t finished;
+    bool stopping;
+    // Tasks in all deques. They are counted before they are pushed, so a
+    // thread that sees none queued has nothing to steal.
+    atomic_uint queued;
+    // The deque the next submission starts at.
+    int next_thread;
+};
+
+// Makes room for count more tasks in the deque of the thread, which must be
+// locked. Returns false if the memory cannot be allocated.
+static bool reserve_tasks(struct task_thread *thread, uint32_t count) {
+    if (thread->capacity - thread->count >= count) {
+        return true;
+    }
+    uint32_t capacity = thread->capacity > 0 ? thread->capacity : 64;
+    while (capacity - thread->count < count) {
+        capacity *= 2;
+    }
+    struct task *tasks = malloc(sizeof(struct task) * capacity);
+    if (tasks == NULL) {
+        return false;
+    }
+    for (uint32_t i = 0; i < thread->count; i++) {
+        tasks[i] = thread->tasks[(thread->head + i) % thread->capacity];
+    }
+    free(thread->tasks);
+    thread->tasks = tasks;
+    thread->capacity = capacity;
+    thread->head = 0;
+    return true;
+}
+
+// Returns the position of the first task of the group in the deque of the
+// thread, which must be locked, searching from the back if newest is true. Any
+// task matches if group is NULL. Returns -1 if none does.
+static int64_t find_task(const struct task_thread *thread,
+                         const struct task_group *group, bool newest) {
+    for (uint32_t i = 0; i < thread->count; i++) {
+        uint32_t position = newest ? thread->count - 1 - i : i;
+        const struct task *task =
+            thread->tasks + (thread->head + position) % thread->capacity;
+        if (group == NULL || task->group == group) {
+            return position;
+        }
+    }
+    return -1;
+}
+
+// Removes the task at the position from the deque of the thread, which must
+// be locked, and returns it in task.
+static void remove_task(struct task_thread *thread, uint32_t position,
+                        struct task *task) {
+    *task = thread->tasks[(thread->head + position) % thread->capacity];
+    if (position == 0) {
+        thread->head = (thread->head + 1) % thread->capacity;
+    } else {
+        // Only a filtered take leaves a gap; close it with the newer tasks.
+        for (uint32_t i = position + 1; i < thread->count; i++) {
+            thread->tasks[(thread->head + i - 1) % thread->capacity] =
+                thread->tasks[(thread->head + i) % thread->capacity];
+        }
+    }
+    thread->count--;
+    atomic_fetch_sub(&task->group->queued, 1);
+}
+
+// Takes the newest task of the thread's own deque, or else the oldest task of
+// another thread, out of the tasks of the group, or of all tasks if group is
+// NULL. Returns false if there is none.
+static bool take_task(struct task_scheduler *scheduler, int index,
+                      const struct task_group *group, struct task *task) {
+    bool taken = false;
+    for (int i = 0; !taken && i < scheduler->thread_count; i++) {
+        struct task_thread *thread =
+            scheduler->threads + (index + i) % scheduler->thread_count;
+        pthread_mutex_lock(&thread->mutex);
+        int64_t position = find_task(thread, group, i == 0);
+        taken = position >= 0;
+        if (taken) {
+            remove_task(thread, (uint32_t)position, task);
+        }
+        pthread_mutex_unlock(&thread->mutex);
+    }
+    if (taken) {
+        atomic_fetch_sub(&scheduler->queued, 1);
+    }
+    return taken;
+}
+
+static void run_task(struct task_scheduler *scheduler, const struct task *task,
+                     int index) {
+    task->function(task->argument, task->index, index);
+    if (atomic_fetch_sub(&task->group->pending, 1) == 1) {
+        pthread_mutex_lock(&scheduler->mutex);
+        pthread_cond_broadcast(&scheduler->finished);
+        pthread_mutex_unlock(&scheduler->mutex);
+    }
+}
+
+static void *run_thread(void *argument) {
+    struct task_thread *thread = argument;
+    struct task_scheduler *scheduler = thread->scheduler;
+    for (;;) {
+        struct task task;
+        if (take_task(scheduler, thread->index, NULL, &task)) {
+            run_task(scheduler, &task, thread->index);
+            continue;
+        }
+        pthread_mutex_lock(&scheduler->mutex);
+        while (atomic_load(&scheduler->queued) == 0 && !scheduler->stopping) {
+            pthread_cond_wait(&scheduler->changed, &scheduler->mutex);
+        }
+        bool stopped =
+            scheduler->stopping && atomic_load(&scheduler->queued) == 0;
+        pthread_mutex_unlock(&scheduler->mutex);
+        if (stopped) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+struct task_scheduler *create_task_scheduler(int thread_count) {
+    if (thread_count < 2) {
+        return NULL;
+    }
+    struct task_scheduler *scheduler =
+        calloc(1, sizeof(struct task_scheduler));
+    if (scheduler == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&scheduler->mutex, NULL);
+    pthread_cond_init(&scheduler->changed, NULL);
+    pthread_cond_init(&scheduler->finished, NULL);
+    atomic_init(&scheduler->queued, 0);
+    scheduler->threads =
+        calloc((size_t)thread_count, sizeof(struct task_thread));
+    if (scheduler->threads == NULL) {
+        destroy_task_scheduler(scheduler);
+        return NULL;
+    }
+    scheduler->thread_count = thread_count;
+    for (int i = 0; i < thread_count; i++) {
+        struct task_thread *thread = scheduler->threads + i;
+        thread->scheduler = scheduler;
+        thread->index = i;
+        pthread_mutex_init(&thread->mutex, NULL);
+    }
+    for (int i = 1; i < thread_count; i++) {
+        struct task_thread *thread = scheduler->threads + i;
+        if (pthread_create(&thread->handle, NULL, run_thread, thread) != 0) {
+            destroy_task_scheduler(scheduler);
+            return NULL;
+        }
+        scheduler->started_count = i;
+    }
+    return scheduler;
+}
+
+void destroy_task_scheduler(struct task_scheduler *scheduler) {
+    if (scheduler == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&scheduler->mutex);
+    scheduler->stopping = true;
+    pthread_cond_broadcast(&scheduler->changed);
+    pthread_mutex_unlock(&scheduler->mutex);
+    for (int i = 1; i <= scheduler->started_count; i++) {
+        pthread_join(scheduler->threads[i].handle, NULL);
+    }
+    for (int i = 0; i < scheduler->thread_count; i++) {
+        pthread_mutex_destroy(&scheduler->threads[i].mutex);
+        free(scheduler->threads[i].tasks);
+    }
+    free(scheduler->threads);
+    pthread_mutex_destroy(&scheduler->mutex);
+    pthread_cond_destroy(&scheduler->changed);
+    pthread_cond_destroy(&scheduler->finished);
+    free(scheduler);
+}
+
+int get_task_thread_count(const struct task_scheduler *scheduler) {
+    return scheduler->thread_count;
+}
+
+void init_task_group(struct task_group *group) {
+    atomic_init(&group->pending, 0);
+    atomic_init(&group->queued, 0);
+}
+
+bool submit_tasks(struct task_scheduler *scheduler, struct task_group *group,
+                  task_function function, void *argument, uint32_t count) {
+    if (count == 0) {
+        return true;
+    }
+    // Only thread 0 pushes, so the room reserved first is still free when
+    // the tasks are pushed.
+    int thread_count = scheduler->thread_count;
+    uint32_t share = (count + thread_count - 1) / thread_count;
+    for (int i = 0; i < thread_count; i++) {
+        struct task_thread *thread = scheduler->threads + i;
+        pthread_mutex_lock(&thread->mutex);
+        bool reserved = reserve_tasks(thread, share);
+        pthread_mutex_unlock(&thread->mutex);
+        if (!reserved) {
+            return false;
+        }
+    }
+    atomic_fetch_add(&group->pending, count);
+    atomic_fetch_add(&group->queued, count);
+    atomic_fetch_add(&scheduler->queued, count);
+    // Deal the tasks out in turn, starting at another deque every time.
+    int first = scheduler->next_thread;
+    scheduler->next_thread = (first + 1) % thread_count;
+    for (int i = 0; i < thread_count; i++) {
+        struct task_thread *thread =
+            scheduler->threads + (first + i) % thread_count;
+        pthread_mutex_lock(&thread->mutex);
+        for (uint32_t t = (uint32_t)i; t < count; t += thread_count) {
+            struct task *task =
+                thread->tasks +
+                (thread->head + thread->count) % thread->capacity;
+            task->function = function;
+            task->argument = argument;
+            task->index = t;
+            task->group = group;
+            thread->count++;
+        }
+        pthread_mutex_unlock(&thread->mutex);
+    }
+    pthread_mutex_lock(&scheduler->mutex);
+    pthread_cond_broadcast(&scheduler->changed);
+    pthread_mutex_unlock(&scheduler->mutex);
+    return true;
+}
+
+void wait_for_tasks(struct task_scheduler *scheduler,
+                    struct task_group *group) {
+    // Only tasks of the group are run here, so that waiting for the stages of
+    // a frame never runs into a long task of another group, such as saving an
+    // earlier frame.
+    while (atomic_load(&group->pending) != 0) {
+        struct task task;
+        if (take_task(scheduler, 0, group, &task)) {
+            run_task(scheduler, &task, 0);
+            continue;
+        }
+        // The remaining tasks of the group are running on other threads. No
+        // more are queued while thread 0 waits, since only it submits tasks.
+        pthread_mutex_lock(&scheduler->mutex);
+        while (atomic_load(&group->pending) != 0 &&
+               atomic_load(&group->queued) == 0) {
+            pthread_cond_wait(&scheduler->finished, &scheduler->mutex);
+        }
+        pthread_mutex_unlock(&scheduler->mutex);
+    }
+}
@@ -0,0 +1,62 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#ifndef TASK_SCHEDULER_H_
+#define TASK_SCHEDULER_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// A fixed set of threads that run the tasks of one render target: the stages
+// of its draws and the saving of its frames. Sharing them keeps a target at
+// the number of threads it was given, however many stages have work at once.
+// Every thread has its own deque of tasks. A thread runs the tasks of its own
+// deque, newest first, and when it runs out steals the oldest task from
+// another thread, so threads only contend when one of them runs dry.
+//
+// Thread 0 is the thread that creates the scheduler. It only runs tasks while
+// it waits for their group; the others are started by the scheduler and sleep
+// while there is nothing to run.
+struct task_scheduler;
+
+// Runs the task with the given index of a submission on the given thread.
+typedef void (*task_function)(void *argument, uint32_t index, int thread);
+
+// Tasks that are waited for together. A stage that depends on another is
+// submitted after waiting for the group of the other.
+struct task_group {
+    // Tasks that have not finished.
+    atomic_uint pending;
+    // Tasks that are still in a deque.
+    atomic_uint queued;
+};
+
+// Creates a scheduler with thread_count threads including the calling one,
+// which must be at least 2. Returns NULL if the threads cannot be started.
+struct task_scheduler *create_task_scheduler(int thread_count);
+
+// Waits for the tasks that are still queued, then stops the threads.
+void destroy_task_scheduler(struct task_scheduler *scheduler);
+
+int get_task_thread_count(const struct task_scheduler *scheduler);
+
+void init_task_group(struct task_group *group);
+
+// Queues count tasks that call function with the argument and the indices 0
+// to count - 1, spread over the deques of all threads, and adds them to the
+// group. Returns false if the deques cannot grow, in which case nothing is
+// queued. Must be called from thread 0. Tasks of the same submission may run
+// in any order and at the same time.
+bool submit_tasks(struct task_scheduler *scheduler, struct task_group *group,
+                  task_function function, void *argument, uint32_t count);
+
+// Runs queued tasks of the group on the calling thread, which must be thread
+// 0, until all tasks of the group have finished. Tasks of other groups are
+// left to the other threads.
+void wait_for_tasks(struct task_scheduler *scheduler,
+                    struct task_group *group);
+
+#endif  // TASK_SCHEDULER_H_
@@ -0,0 +1,755 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#include "tile_renderer.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graphics/framebuffer.h"
+#include "graphics/rasterizer.h"
+#include "graphics/texture.h"
+#include "math/vector.h"
+
+#include "baked_mesh.h"
+#include "frame_arena.h"
+#include "profiler.h"
+#include "task_scheduler.h"
+
+// Vertices are shaded in tasks of this many vertices.
+#define SHADING_BATCH_SIZE 1024
+// Size of the blocks of the coarse depth buffer built by the depth pre-pass.
+#define DEPTH_BLOCK_SIZE 8
+#define DEPTH_BLOCKS_PER_ROW (TILE_SIZE / DEPTH_BLOCK_SIZE)
+#define DEPTH_BLOCKS_PER_TILE (DEPTH_BLOCKS_PER_ROW * DEPTH_BLOCKS_PER_ROW)
+// Depths of the coarse depth buffer are 16-bit unsigned normalized, mapping
+// [0, 1] to [0, COARSE_DEPTH_MAX].
+#define COARSE_DEPTH_MAX UINT16_MAX
+
+struct tile_worker {
+    struct framebuffer *framebuffer;
+    struct texture *color_buffer;
+    struct texture *depth_buffer;
+};
+
+// The tiles a triangle overlaps, inclusive on both ends.
+struct tile_rect {
+    uint16_t min_x, min_y, max_x, max_y;
+};
+
+struct triangle_bounds {
+    // Screen-space bounding box in pixels.
+    float min_x, min_y, max_x, max_y;
+    // Coarse depth of the nearest vertex, rounded down. Zero if it is
+    // unknown because the triangle crosses the camera plane.
+    uint16_t min_depth;
+    // Edge functions a * x + b * y + c of the screen-space triangle, oriented
+    // to be positive inside. All zero if the tiles are not tested against
+    // them.
+    float edge_a[3], edge_b[3], edge_c[3];
+    struct tile_rect tiles;
+};
+
+// The tiles of a target buffer that are known to hold the clear value, so
+// that tiles no triangle overlaps do not have to be written again.
+struct cleared_tiles {
+    const struct texture *buffer;
+    uint8_t *tiles;
+};
+
+struct tile_renderer {
+    uint32_t width, height;
+    uint32_t tile_columns, tile_rows;
+    struct task_scheduler *scheduler;
+    // One worker for every thread of the scheduler.
+    int thread_count;
+    struct tile_worker *workers;
+    // Triangles of tile i are bin_triangles[bin_offsets[i]] up to
+    // bin_triangles[bin_offsets[i + 1]]. The triangles and their bounds are
+    // allocated for each draw from the arena of its vertex cache.
+    uint32_t *bin_offsets;
+    uint32_t *bin_triangles;
+    struct triangle_bounds *bounds;
+    // The farthest depth of every block of every tile as a coarse depth
+    // rounded up, written by the depth pre-pass.
+    uint16_t *block_max_depths;
+    // A row of the clear color and of the clear depth, which the flags of the
+    // cleared tiles refer to.
+    uint8_t clear_color_row[TILE_SIZE * 4];
+    uint8_t clear_depth_row[TILE_SIZE * sizeof(float)];
+    // One entry for every target buffer drawn into. The frame writer rotates
+    // between several color buffers, so each keeps its own flags.
+    int cleared_buffer_count;
+    struct cleared_tiles *cleared_buffers;
+};
+
+// A vertex of a triangle moved into the clip space of one tile.
+struct tile_vertex {
+    vector4 position;
+    const struct shader_context *context;
+};
+
+struct tile_job {
+    struct tile_renderer *renderer;
+    vertex_shader shader;
+    batch_vertex_shader batch_shader;
+    fragment_shader fragment_shader;
+    bool depth_prepass;
+    const void *uniform;
+    const struct baked_mesh *mesh;
+    struct shaded_vertex *shaded;
+    struct texture *color_buffer;
+    struct texture *depth_buffer;
+    // The cleared tile flags of the color and depth buffer.
+    uint8_t *cleared_colors;
+    uint8_t *cleared_depths;
+};
+
+int get_tile_thread_count(void) {
+    const char *value = getenv("ANIM_TILE_THREADS");
+    if (value == NULL) {
+        return 1;
+    }
+    int count = atoi(value);
+    return count > 0 ? count : 1;
+}
+
+struct tile_renderer *create_tile_renderer(uint32_t width, uint32_t height,
+                                           struct task_scheduler *scheduler) {
+    struct tile_renderer *renderer = calloc(1, sizeof(struct tile_renderer));
+    if (renderer == NULL) {
+        return NULL;
+    }
+    renderer->width = width;
+    renderer->height = height;
+    renderer->tile_columns = (width + TILE_SIZE - 1) / TILE_SIZE;
+    renderer->tile_rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+    renderer->scheduler = scheduler;
+    renderer->thread_count = get_task_thread_count(scheduler);
+    uint32_t tile_count = renderer->tile_columns * renderer->tile_rows;
+    renderer->bin_offsets = malloc(sizeof(uint32_t) * (tile_count + 1));
+    renderer->block_max_depths =
+        malloc(sizeof(uint16_t) * DEPTH_BLOCKS_PER_TILE * tile_count);
+    renderer->workers =
+        calloc((size_t)renderer->thread_count, sizeof(struct tile_worker));
+    if (renderer->bin_offsets == NULL || renderer->block_max_depths == NULL ||
+        renderer->workers == NULL) {
+        destroy_tile_renderer(renderer);
+        return NULL;
+    }
+    for (int i = 0; i < renderer->thread_count; i++) {
+        struct tile_worker *worker = renderer->workers + i;
+        worker->framebuffer = create_framebuffer();
+        worker->color_buffer =
+            create_texture(TEXTURE_FORMAT_SRGB8_A8, TILE_SIZE, TILE_SIZE);
+        worker->depth_buffer =
+            create_texture(TEXTURE_FORMAT_DEPTH_FLOAT, TILE_SIZE, TILE_SIZE);
+        if (worker->framebuffer == NULL || worker->color_buffer == NULL ||
+            worker->depth_buffer == NULL) {
+            destroy_tile_renderer(renderer);
+            return NULL;
+        }
+        attach_texture_to_framebuffer(worker->framebuffer, COLOR_ATTACHMENT,
+                                      worker->color_buffer);
+        attach_texture_to_framebuffer(worker->framebuffer, DEPTH_ATTACHMENT,
+                                      worker->depth_buffer);
+    }
+    return renderer;
+}
+
+void destroy_tile_renderer(struct tile_renderer *renderer) {
+    if (renderer == NULL) {
+        return;
+    }
+    if (renderer->workers != NULL) {
+        for (int i = 0; i < renderer->thread_count; i++) {
+            struct tile_worker *worker = renderer->workers + i;
+            destroy_texture(worker->color_buffer);
+            destroy_texture(worker->depth_buffer);
+            if (worker->framebuffer != NULL) {
+                destroy_framebuffer(worker->framebuffer);
+            }
+        }
+    }
+    free(renderer->workers);
+    for (int i = 0; i < renderer->cleared_buffer_count; i++) {
+        free(renderer->cleared_buffers[i].tiles);
+    }
+    free(renderer->cleared_buffers);
+    free(renderer->bin_offsets);
+    free(renderer->block_max_depths);
+    free(renderer);
+}
+
+// Runs count tasks of the function on the threads of the scheduler, including
+// the calling thread, and waits for them. Runs them all on the calling thread
+// if they cannot be queued.
+static void run_tasks(struct tile_renderer *renderer, task_function function,
+                      struct tile_job *job, uint32_t count) {
+    struct task_group group;
+    init_task_group(&group);
+    if (!submit_tasks(renderer->scheduler, &group, function, job, count)) {
+        for (uint32_t i = 0; i < count; i++) {
+            function(job, i, 0);
+        }
+        return;
+    }
+    wait_for_tasks(renderer->scheduler, &group);
+}
+
+static void shade_vertex_batch(void *argument, uint32_t batch, int thread) {
+    (void)thread;
+    struct tile_job *job = argument;
+    const struct baked_mesh *mesh = job->mesh;
+    struct vertex_cache cache = {0};
+    cache.capacity = mesh->vertex_count;
+    cache.vertices = job->shaded;
+    uint32_t first = batch * SHADING_BATCH_SIZE;
+    uint32_t last = first + SHADING_BATCH_SIZE;
+    if (last > mesh->vertex_count) {
+        last = mesh->vertex_count;
+    }
+    shade_vertex_range(job->shader, job->batch_shader, job->uniform, mesh,
+                       &cache, first, last);
+}
+
+// Converts a depth to the coarse depth buffer, rounding down or up. Depths
+// are clamped to [0, 1].
+static uint16_t floor_coarse_depth(float depth) {
+    depth = fminf(fmaxf(depth, 0.0f), 1.0f);
+    return (uint16_t)floorf(depth * COARSE_DEPTH_MAX);
+}
+
+static uint16_t ceil_coarse_depth(float depth) {
+    depth = fminf(fmaxf(depth, 0.0f), 1.0f);
+    return (uint16_t)ceilf(depth * COARSE_DEPTH_MAX);
+}
+
+static int clamp_tile(float tile, uint32_t tile_count) {
+    if (tile < 0.0f) {
+        return 0;
+    }
+    if (tile >= (float)tile_count) {
+        return (int)tile_count - 1;
+    }
+    return (int)tile;
+}
+
+// Finds the tiles covered by the screen-space bounding box of the triangle,
+// grown by a pixel so that rounding in the rasterizer cannot miss a tile, and
+// sets up the edge functions that bin_triangles() tests those tiles against.
+// Returns false if the triangle lies entirely outside the target.
+static bool get_triangle_bounds(const struct tile_renderer *renderer,
+                                const struct shaded_vertex *vertices[3],
+                                struct triangle_bounds *bounds) {
+    float screen_x[3], screen_y[3];
+    float min_depth = INFINITY;
+    bounds->min_x = bounds->min_y = INFINITY;
+    bounds->max_x = bounds->max_y = -INFINITY;
+    for (int v = 0; v < 3; v++) {
+        vector4 position = vertices[v]->position;
+        if (position.w <= 0.0f) {
+            // Part of the triangle is behind the camera. Leave it to the
+            // rasterizer's clipping and bin it everywhere.
+            bounds->min_x = bounds->min_y = 0.0f;
+            bounds->max_x = (float)renderer->width;
+            bounds->max_y = (float)renderer->height;
+            bounds->min_depth = 0;
+            bounds->tiles.min_x = bounds->tiles.min_y = 0;
+            bounds->tiles.max_x = (uint16_t)(renderer->tile_columns - 1);
+            bounds->tiles.max_y = (uint16_t)(renderer->tile_rows - 1);
+            memset(bounds->edge_a, 0, sizeof(bounds->edge_a));
+            memset(bounds->edge_b, 0, sizeof(bounds->edge_b));
+            memset(bounds->edge_c, 0, sizeof(bounds->edge_c));
+            return true;
+        }
+        float x = (position.x / position.w + 1.0f) * 0.5f * renderer->width;
+        float y = (position.y / position.w + 1.0f) * 0.5f * renderer->height;
+        float depth = (position.z / position.w + 1.0f) * 0.5f;
+        screen_x[v] = x;
+        screen_y[v] = y;
+        bounds->min_x = fminf(bounds->min_x, x);
+        bounds->min_y = fminf(bounds->min_y, y);
+        bounds->max_x = fmaxf(bounds->max_x, x);
+        bounds->max_y = fmaxf(bounds->max_y, y);
+        min_depth = fminf(min_depth, depth);
+    }
+    bounds->min_depth = floor_coarse_depth(min_depth);
+    if (bounds->max_x < -1.0f || bounds->max_y < -1.0f ||
+        bounds->min_x > renderer->width + 1.0f ||
+        bounds->min_y > renderer->height + 1.0f) {
+        return false;
+    }
+    struct tile_rect *tiles = &bounds->tiles;
+    tiles->min_x = (uint16_t)clamp_tile((bounds->min_x - 1.0f) / TILE_SIZE,
+                                        renderer->tile_columns);
+    tiles->min_y = (uint16_t)clamp_tile((bounds->min_y - 1.0f) / TILE_SIZE,
+                                        renderer->tile_rows);
+    tiles->max_x = (uint16_t)clamp_tile((bounds->max_x + 1.0f) / TILE_SIZE,
+                                        renderer->tile_columns);
+    tiles->max_y = (uint16_t)clamp_tile((bounds->max_y + 1.0f) / TILE_SIZE,
+                                        renderer->tile_rows);
+
+    float area = (screen_x[1] - screen_x[0]) * (screen_y[2] - screen_y[0]) -
+                 (screen_y[1] - screen_y[0]) * (screen_x[2] - screen_x[0]);
+    // Degenerate triangles and triangles within a single tile keep zero edge
+    // functions, which never reject a tile.
+    float sign = 0.0f;
+    if (tiles->min_x != tiles->max_x || tiles->min_y != tiles->max_y) {
+        sign = area > 0.0f ? -1.0f : (area < 0.0f ? 1.0f : 0.0f);
+    }
+    for (int e = 0; e < 3; e++) {
+        int next = (e + 1) % 3;
+        float a = sign * (screen_y[next] - screen_y[e]);
+        float b = sign * (screen_x[e] - screen_x[next]);
+        bounds->edge_a[e] = a;
+        bounds->edge_b[e] = b;
+        bounds->edge_c[e] = -(a * screen_x[e] + b * screen_y[e]);
+    }
+    return true;
+}
+
+// Returns false if the tile, grown by a pixel like the bounding box, lies
+// entirely outside one of the edges of the triangle.
+static bool does_triangle_overlap_tile(const struct triangle_bounds *bounds,
+                                       uint32_t tile_x, uint32_t tile_y) {
+    float min_x = (float)(tile_x * TILE_SIZE) - 1.0f;
+    float min_y = (float)(tile_y * TILE_SIZE) - 1.0f;
+    float max_x = min_x + TILE_SIZE + 2.0f;
+    float max_y = min_y + TILE_SIZE + 2.0f;
+    for (int e = 0; e < 3; e++) {
+        // Evaluate the edge at the corner of the tile that is farthest
+        // inside it.
+        float a = bounds->edge_a[e];
+        float b = bounds->edge_b[e];
+        float x = a > 0.0f ? max_x : min_x;
+        float y = b > 0.0f ? max_y : min_y;
+        if (a * x + b * y + bounds->edge_c[e] < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool bin_triangles(struct tile_renderer *renderer,
+                          const struct baked_mesh *mesh,
+                          const struct shaded_vertex *shaded,
+                          struct frame_arena *arena) {
+    uint32_t triangle_count = mesh->triangle_count;
+    renderer->bounds = allocate_from_arena(
+        arena, sizeof(struct triangle_bounds) * triangle_count);
+    if (renderer->bounds == NULL) {
+        return false;
+    }
+
+    // Count the triangles of every tile first, then place them in triangle
+    // order so that each tile draws its triangles in submission order.
+    uint32_t tile_count = renderer->tile_columns * renderer->tile_rows;
+    uint32_t *offsets = renderer->bin_offsets;
+    memset(offsets, 0, sizeof(uint32_t) * (tile_count + 1));
+    const uint32_t *indices = mesh->indices;
+    uint32_t unbinned_count = 0;
+    for (uint32_t t = 0; t < triangle_count; t++, indices += 3) {
+        const struct shaded_vertex *vertices[3] = {
+            shaded + indices[0], shaded + indices[1], shaded + indices[2]};
+        struct triangle_bounds *bounds = renderer->bounds + t;
+        struct tile_rect *rect = &bounds->tiles;
+        if (!get_triangle_bounds(renderer, vertices, bounds)) {
+            *rect = (struct tile_rect){1, 1, 0, 0};
+            unbinned_count++;
+            continue;
+        }
+        bool binned = false;
+        for (uint32_t y = rect->min_y; y <= rect->max_y; y++) {
+            for (uint32_t x = rect->min_x; x <= rect->max_x; x++) {
+                if (does_triangle_overlap_tile(bounds, x, y)) {
+                    offsets[y * renderer->tile_columns + x + 1]++;
+                    binned = true;
+                }
+            }
+        }
+        if (!binned) {
+            unbinned_count++;
+        }
+    }
+    add_profile_count(PROFILE_COUNTER_UNBINNED_TRIANGLES, unbinned_count);
+    for (uint32_t i = 0; i < tile_count; i++) {
+        offsets[i + 1] += offsets[i];
+    }
+    uint32_t reference_count = offsets[tile_count];
+    add_profile_count(PROFILE_COUNTER_TILE_TRIANGLES, reference_count);
+    renderer->bin_triangles =
+        allocate_from_arena(arena, sizeof(uint32_t) * reference_count);
+    if (renderer->bin_triangles == NULL) {
+        return false;
+    }
+    // Use the offsets as write cursors: afterwards offsets[i] is where bin
+    // i + 1 starts, so shift them back by one tile.
+    for (uint32_t t = 0; t < triangle_count; t++) {
+        const struct triangle_bounds *bounds = renderer->bounds + t;
+        const struct tile_rect *rect = &bounds->tiles;
+        for (uint32_t y = rect->min_y; y <= rect->max_y; y++) {
+            for (uint32_t x = rect->min_x; x <= rect->max_x; x++) {
+                if (does_triangle_overlap_tile(bounds, x, y)) {
+                    uint32_t tile = y * renderer->tile_columns + x;
+                    renderer->bin_triangles[offsets[tile]++] = t;
+                }
+            }
+        }
+    }
+    memmove(offsets + 1, offsets, sizeof(uint32_t) * tile_count);
+    offsets[0] = 0;
+    return true;
+}
+
+static vector4 tile_vertex_shader(struct shader_context *output,
+                                  const void *uniform, const void *vertex) {
+    (void)uniform;
+    const struct tile_vertex *tile_vertex = vertex;
+    *output = *tile_vertex->context;
+    return tile_vertex->position;
+}
+
+static vector4 tile_depth_vertex_shader(struct shader_context *output,
+                                        const void *uniform,
+                                        const void *vertex) {
+    (void)output;
+    (void)uniform;
+    return ((const struct tile_vertex *)vertex)->position;
+}
+
+static void copy_tile(struct texture *target, const struct texture *tile,
+                      uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                      size_t pixel_size) {
+    uint8_t *target_pixels = target->pixels;
+    const uint8_t *tile_pixels = tile->pixels;
+    for (uint32_t row = 0; row < height; row++) {
+        memcpy(target_pixels + ((size_t)(y + row) * target->width + x) *
+                                   pixel_size,
+               tile_pixels + (size_t)row * tile->width * pixel_size,
+               width * pixel_size);
+    }
+}
+
+static void copy_tile_back(struct texture *tile, const struct texture *target,
+                           uint32_t x, uint32_t y, uint32_t width,
+                           uint32_t height, size_t pixel_size) {
+    uint8_t *tile_pixels = tile->pixels;
+    const uint8_t *target_pixels = target->pixels;
+    for (uint32_t row = 0; row < height; row++) {
+        memcpy(tile_pixels + (size_t)row * tile->width * pixel_size,
+               target_pixels + ((size_t)(y + row) * target->width + x) *
+                                   pixel_size,
+               width * pixel_size);
+    }
+}
+
+// Writes row, the clear value of a whole tile row, to every row of the region.
+static void fill_tile(struct texture *target, const uint8_t *row, uint32_t x,
+                      uint32_t y, uint32_t width, uint32_t height,
+                      size_t pixel_size) {
+    uint8_t *target_pixels = target->pixels;
+    for (uint32_t r = 0; r < height; r++) {
+        memcpy(target_pixels + ((size_t)(y + r) * target->width + x) *
+                                   pixel_size,
+               row, width * pixel_size);
+    }
+}
+
+// Returns the cleared tile flags of the buffer, which start out all unset the
+// first time the buffer is drawn into. Returns NULL if the memory cannot be
+// allocated.
+static uint8_t *get_cleared_tiles(struct tile_renderer *renderer,
+                                  const struct texture *buffer) {
+    for (int i = 0; i < renderer->cleared_buffer_count; i++) {
+        if (renderer->cleared_buffers[i].buffer == buffer) {
+            return renderer->cleared_buffers[i].tiles;
+        }
+    }
+    size_t count = (size_t)renderer->cleared_buffer_count + 1;
+    struct cleared_tiles *grown = realloc(
+        renderer->cleared_buffers, sizeof(struct cleared_tiles) * count);
+    if (grown == NULL) {
+        return NULL;
+    }
+    renderer->cleared_buffers = grown;
+    uint8_t *tiles = calloc(renderer->tile_columns * renderer->tile_rows, 1);
+    if (tiles == NULL) {
+        return NULL;
+    }
+    grown[renderer->cleared_buffer_count].buffer = buffer;
+    grown[renderer->cleared_buffer_count].tiles = tiles;
+    renderer->cleared_buffer_count++;
+    return tiles;
+}
+
+// Finds the current clear values by clearing the tile of the first worker, and
+// forgets which tiles hold the clear values if they changed since the last
+// draw.
+static void update_clear_rows(struct tile_renderer *renderer) {
+    const struct tile_worker *worker = renderer->workers;
+    clear_framebuffer(worker->framebuffer);
+    if (memcmp(renderer->clear_color_row, worker->color_buffer->pixels,
+               sizeof(renderer->clear_color_row)) == 0 &&
+        memcmp(renderer->clear_depth_row, worker->depth_buffer->pixels,
+               sizeof(renderer->clear_depth_row)) == 0) {
+        return;
+    }
+    memcpy(renderer->clear_color_row, worker->color_buffer->pixels,
+           sizeof(renderer->clear_color_row));
+    memcpy(renderer->clear_depth_row, worker->depth_buffer->pixels,
+           sizeof(renderer->clear_depth_row));
+    uint32_t tile_count = renderer->tile_columns * renderer->tile_rows;
+    for (int i = 0; i < renderer->cleared_buffer_count; i++) {
+        memset(renderer->cleared_buffers[i].tiles, 0, tile_count);
+    }
+}
+
+// Maps the pixels of a tile to the whole tile-sized viewport.
+struct tile_transform {
+    uint32_t origin_x, origin_y;
+    uint32_t width, height;
+    float scale_x, scale_y;
+    float offset_x, offset_y;
+};
+
+static void get_tile_transform(const struct tile_renderer *renderer,
+                               uint32_t tile,
+                               struct tile_transform *transform) {
+    transform->origin_x = tile % renderer->tile_columns * TILE_SIZE;
+    transform->origin_y = tile / renderer->tile_columns * TILE_SIZE;
+    uint32_t width = renderer->width - transform->origin_x;
+    uint32_t height = renderer->height - transform->origin_y;
+    transform->width = width < TILE_SIZE ? width : TILE_SIZE;
+    transform->height = height < TILE_SIZE ? height : TILE_SIZE;
+    // Scale and offset clip space so that the tile's pixels cover the
+    // viewport.
+    transform->scale_x = (float)renderer->width / TILE_SIZE;
+    transform->scale_y = (float)renderer->height / TILE_SIZE;
+    transform->offset_x = (float)((int)renderer->width -
+                                  2 * (int)transform->origin_x - TILE_SIZE) /
+                          TILE_SIZE;
+    transform->offset_y = (float)((int)renderer->height -
+                                  2 * (int)transform->origin_y - TILE_SIZE) /
+                          TILE_SIZE;
+}
+
+static void draw_tile_triangle(const struct tile_job *job,
+                               struct tile_worker *worker,
+                               const struct tile_transform *transform,
+                               uint32_t triangle, float depth_bias) {
+    const uint32_t *indices = job->mesh->indices + triangle * 3;
+    struct tile_vertex vertices[3];
+    const void *vertex_ptrs[3];
+    for (int v = 0; v < 3; v++) {
+        const struct shaded_vertex *shaded = job->shaded + indices[v];
+        vector4 position = shaded->position;
+        position.x = position.x * transform->scale_x +
+                     position.w * transform->offset_x;
+        position.y = position.y * transform->scale_y +
+                     position.w * transform->offset_y;
+        position.z += depth_bias * position.w;
+        vertices[v].position = position;
+        vertices[v].context = &shaded->context;
+        vertex_ptrs[v] = vertices + v;
+    }
+    draw_triangle(worker->framebuffer, job->uniform, vertex_ptrs);
+}
+
+// Returns true if the triangle is behind the depth the pre-pass left in every
+// block of the tile it may touch.
+static bool is_triangle_occluded(const struct tile_renderer *renderer,
+                                 const struct tile_transform *transform,
+                                 uint32_t tile, uint32_t triangle) {
+    const struct triangle_bounds *bounds = renderer->bounds + triangle;
+    float min_x = bounds->min_x - 1.0f - (float)transform->origin_x;
+    float min_y = bounds->min_y - 1.0f - (float)transform->origin_y;
+    float max_x = bounds->max_x + 1.0f - (float)transform->origin_x;
+    float max_y = bounds->max_y + 1.0f - (float)transform->origin_y;
+    int block_min_x = (int)fmaxf(min_x, 0.0f) / DEPTH_BLOCK_SIZE;
+    int block_min_y = (int)fmaxf(min_y, 0.0f) / DEPTH_BLOCK_SIZE;
+    int block_max_x = (int)fminf(max_x, TILE_SIZE - 1.0f) / DEPTH_BLOCK_SIZE;
+    int block_max_y = (int)fminf(max_y, TILE_SIZE - 1.0f) / DEPTH_BLOCK_SIZE;
+    const uint16_t *block_max_depths =
+        renderer->block_max_depths + tile * DEPTH_BLOCKS_PER_TILE;
+    for (int y = block_min_y; y <= block_max_y; y++) {
+        for (int x = block_min_x; x <= block_max_x; x++) {
+            if (bounds->min_depth <=
+                block_max_depths[y * DEPTH_BLOCKS_PER_ROW + x]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void build_block_max_depths(struct tile_renderer *renderer,
+                                   const struct texture *depth_buffer,
+                                   uint32_t tile) {
+    const float *depths = depth_buffer->pixels;
+    uint16_t *block_max_depths =
+        renderer->block_max_depths + tile * DEPTH_BLOCKS_PER_TILE;
+    for (int block = 0; block < DEPTH_BLOCKS_PER_TILE; block++) {
+        int origin_x = block % DEPTH_BLOCKS_PER_ROW * DEPTH_BLOCK_SIZE;
+        int origin_y = block / DEPTH_BLOCKS_PER_ROW * DEPTH_BLOCK_SIZE;
+        float max_depth = 0.0f;
+        for (int y = origin_y; y < origin_y + DEPTH_BLOCK_SIZE; y++) {
+            for (int x = origin_x; x < origin_x + DEPTH_BLOCK_SIZE; x++) {
+                max_depth = fmaxf(max_depth, depths[y * TILE_SIZE + x]);
+            }
+        }
+        block_max_depths[block] = ceil_coarse_depth(max_depth);
+    }
+}
+
+static void render_tile_depth(struct tile_job *job, struct tile_worker *worker,
+                              uint32_t tile) {
+    struct tile_renderer *renderer = job->renderer;
+    uint32_t begin = renderer->bin_offsets[tile];
+    uint32_t end = renderer->bin_offsets[tile + 1];
+    if (begin == end) {
+        // render_tile() clears the tile, and nothing is tested against its
+        // blocks.
+        return;
+    }
+    struct tile_transform transform;
+    get_tile_transform(renderer, tile, &transform);
+    clear_framebuffer(worker->framebuffer);
+    for (uint32_t i = begin; i < end; i++) {
+        draw_tile_triangle(job, worker, &transform, renderer->bin_triangles[i],
+                           DEPTH_PREPASS_BIAS);
+    }
+    build_block_max_depths(renderer, worker->depth_buffer, tile);
+    // The tile framebuffer is reused for other tiles before the shading pass,
+    // so keep the depth in the target until then.
+    copy_tile(job->depth_buffer, worker->depth_buffer, transform.origin_x,
+              transform.origin_y, transform.width, transform.height,
+              sizeof(float));
+}
+
+static void render_tile(struct tile_job *job, struct tile_worker *worker,
+                        uint32_t tile) {
+    const struct tile_renderer *renderer = job->renderer;
+    struct tile_transform transform;
+    get_tile_transform(renderer, tile, &transform);
+    uint32_t begin = renderer->bin_offsets[tile];
+    uint32_t end = renderer->bin_offsets[tile + 1];
+    if (begin == end) {
+        // Fast clear: a tile without triangles is written straight from the
+        // clear values, and not at all if the buffer already holds them.
+        if (!job->cleared_colors[tile]) {
+            fill_tile(job->color_buffer, renderer->clear_color_row,
+                      transform.origin_x, transform.origin_y, transform.width,
+                      transform.height, 4);
+            job->cleared_colors[tile] = 1;
+        }
+        if (!job->cleared_depths[tile]) {
+            fill_tile(job->depth_buffer, renderer->clear_depth_row,
+                      transform.origin_x, transform.origin_y, transform.width,
+                      transform.height, sizeof(float));
+            job->cleared_depths[tile] = 1;
+        }
+        return;
+    }
+    clear_framebuffer(worker->framebuffer);
+    if (job->depth_prepass) {
+        copy_tile_back(worker->depth_buffer, job->depth_buffer,
+                       transform.origin_x, transform.origin_y, transform.width,
+                       transform.height, sizeof(float));
+    }
+    uint32_t occluded_count = 0;
+    for (uint32_t i = begin; i < end; i++) {
+        uint32_t triangle = renderer->bin_triangles[i];
+        if (job->depth_prepass &&
+            is_triangle_occluded(renderer, &transform, tile, triangle)) {
+            occluded_count++;
+            continue;
+        }
+        draw_tile_triangle(job, worker, &transform, triangle, 0.0f);
+    }
+    add_profile_count(PROFILE_COUNTER_OCCLUDED_TRIANGLES, occluded_count);
+    copy_tile(job->color_buffer, worker->color_buffer, transform.origin_x,
+              transform.origin_y, transform.width, transform.height, 4);
+    copy_tile(job->depth_buffer, worker->depth_buffer, transform.origin_x,
+              transform.origin_y, transform.width, transform.height,
+              sizeof(float));
+    job->cleared_colors[tile] = 0;
+    job->cleared_depths[tile] = 0;
+}
+
+static void render_tile_depth_task(void *argument, uint32_t tile,
+                                   int thread) {
+    struct tile_job *job = argument;
+    render_tile_depth(job, job->renderer->workers + thread, tile);
+}
+
+static void render_tile_task(void *argument, uint32_t tile, int thread) {
+    struct tile_job *job = argument;
+    render_tile(job, job->renderer->workers + thread, tile);
+}
+
+bool draw_indexed_tiled(struct tile_renderer *renderer,
+                        struct texture *color_buffer,
+                        struct texture *depth_buffer,
+                        vertex_shader vertex_shader,
+                        batch_vertex_shader batch_vertex_shader,
+                        fragment_shader fragment_shader, const void *uniform,
+                        const struct baked_mesh *mesh,
+                        struct vertex_cache *cache, bool depth_prepass) {
+    if (!reserve_vertex_cache(cache, mesh->vertex_count)) {
+        return false;
+    }
+    struct tile_job job;
+    job.renderer = renderer;
+    job.shader = vertex_shader;
+    job.batch_shader = batch_vertex_shader;
+    job.fragment_shader = fragment_shader;
+    job.depth_prepass = depth_prepass;
+    job.uniform = uniform;
+    job.mesh = mesh;
+    job.shaded = cache->vertices;
+    job.color_buffer = color_buffer;
+    job.depth_buffer = depth_buffer;
+    job.cleared_colors = get_cleared_tiles(renderer, color_buffer);
+    job.cleared_depths = get_cleared_tiles(renderer, depth_buffer);
+    if (job.cleared_colors == NULL || job.cleared_depths == NULL) {
+        return false;
+    }
+    double start = get_profile_time();
+    run_tasks(renderer, shade_vertex_batch, &job,
+              (mesh->vertex_count + SHADING_BATCH_SIZE - 1) /
+                  SHADING_BATCH_SIZE);
+    add_profile_time(PROFILE_STAGE_VERTEX, start);
+
+    start = get_profile_time();
+    bool binned = bin_triangles(renderer, mesh, job.shaded, cache->arena);
+    add_profile_time(PROFILE_STAGE_BINNING, start);
+    if (!binned) {
+        return false;
+    }
+
+    start = get_profile_time();
+    update_clear_rows(renderer);
+    add_profile_time(PROFILE_STAGE_CLEAR, start);
+    set_viewport(0, 0, TILE_SIZE, TILE_SIZE);
+    uint32_t tile_count = renderer->tile_columns * renderer->tile_rows;
+    if (depth_prepass) {
+        start = get_profile_time();
+        set_vertex_shader(tile_depth_vertex_shader);
+        set_fragment_shader(depth_only_fragment_shader);
+        run_tasks(renderer, render_tile_depth_task, &job, tile_count);
+        add_profile_time(PROFILE_STAGE_DEPTH_PREPASS, start);
+    }
+    start = get_profile_time();
+    set_vertex_shader(tile_vertex_shader);
+    set_fragment_shader(fragment_shader);
+    run_tasks(renderer, render_tile_task, &job, tile_count);
+    add_profile_time(PROFILE_STAGE_RASTER, start);
+    return true;
+}
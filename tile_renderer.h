@@ -0,0 +1,67 @@
+// Copyright (c) Caden Ji. All rights reserved.
+//
+// Licensed under the MIT License. See LICENSE file in the project root for
+// license information.
+
+#ifndef TILE_RENDERER_H_
+#define TILE_RENDERER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "graphics/rasterizer.h"
+#include "graphics/texture.h"
+
+#include "baked_mesh.h"
+#include "task_scheduler.h"
+
+#define TILE_SIZE 64
+
+// Splits a frame into TILE_SIZE x TILE_SIZE screen tiles and rasterizes them
+// as tasks on the threads of a task scheduler. Every thread renders into a
+// private tile-sized framebuffer and copies the finished tile into its own
+// region of the target, so no two threads ever write to the same pixels.
+struct tile_renderer;
+
+// Returns the number of threads each frame is rendered with: the
+// ANIM_TILE_THREADS environment variable if it is set, otherwise 1.
+int get_tile_thread_count(void);
+
+// Creates a tile renderer for targets of the given size that renders on the
+// threads of the scheduler, which must outlive it. Returns NULL if the tile
+// framebuffers cannot be created.
+struct tile_renderer *create_tile_renderer(uint32_t width, uint32_t height,
+                                           struct task_scheduler *scheduler);
+
+void destroy_tile_renderer(struct tile_renderer *renderer);
+
+// Renders the mesh as the only draw of a frame, from thread 0 of the
+// scheduler. Vertices are shaded in parallel, triangles are binned into the
+// tiles they overlap, and each tile is cleared to the clear color and drawn
+// with the fragment shader, keeping the submission order of the triangles
+// within the tile. The whole color and depth buffer are overwritten, so the
+// target does not need to be cleared first. Tiles that no triangle overlaps
+// are set to the clear values without rasterizing them, and left alone if the
+// buffer still holds the clear values there from an earlier draw, so the
+// buffers must not be written by anything else between draws. The fragment
+// shader must be safe to call from several threads at once.
+//
+// With depth_prepass, every tile first gets a depth-only pass as described for
+// draw_shaded_depth(), and the farthest depth of each 8x8 block of the tile is
+// kept as a 16-bit value rounded up. The shading pass then skips triangles
+// whose nearest depth, rounded down, is behind that depth in all blocks they
+// may touch without rasterizing them.
+//
+// This changes the viewport and the bound shaders. Returns false if the memory
+// for shading or binning cannot be allocated from the arena of the cache, or
+// the flags of the cleared tiles cannot be allocated.
+bool draw_indexed_tiled(struct tile_renderer *renderer,
+                        struct texture *color_buffer,
+                        struct texture *depth_buffer,
+                        vertex_shader vertex_shader,
+                        batch_vertex_shader batch_vertex_shader,
+                        fragment_shader fragment_shader, const void *uniform,
+                        const struct baked_mesh *mesh,
+                        struct vertex_cache *cache, bool depth_prepass);
+
+#endif  // TILE_RENDERER_H_